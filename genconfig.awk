@@ -0,0 +1,154 @@
+# Turns an lwm.conf into config.h for `make static-config`.
+
+function cstr(v) {
+    gsub(/\\/, "\\\\", v)
+    gsub(/"/, "\\\"", v)
+    return "\"" v "\""
+}
+
+function modmask(m,    r) {
+    r = ""
+    if (m ~ /Mod1/) r = r "|Mod1Mask"
+    if (m ~ /Mod4/) r = r "|Mod4Mask"
+    if (m ~ /Shift/) r = r "|ShiftMask"
+    if (m ~ /Control/) r = r "|ControlMask"
+    return r == "" ? "0" : substr(r, 2)
+}
+
+function action(cmd,    c, w) {
+    c = tolower(cmd)
+    if (c in actions) return "ACT_" toupper(c) ", 0"
+    if (split(c, w, " ") == 2 && (w[1] in argactions) && w[2] ~ /^[0-9]+$/)
+        return "ACT_" toupper(w[1]) ", " (w[2] + 0)
+    return "ACT_SPAWN, 0"
+}
+
+BEGIN {
+    n = split("quit restart alttab menu unhide close fullscreen snap_left snap_right maximize restore tile grid float", a, " ")
+    for (i = 1; i <= n; i++) actions[a[i]] = 1
+    n = split("workspace move_to", a, " ")
+    for (i = 1; i <= n; i++) argactions[a[i]] = 1
+
+    keys = "BAR_COLOR BG_COLOR BORDER_COLOR ACTIVE_BORDER_COLOR BUTTON_COLOR TEXT_COLOR LINE_COLOR HIGHLIGHT_COLOR FONT MOUSE_MOD"
+    val["BAR_COLOR"] = "#4C837E"
+    val["BG_COLOR"] = "#83A597"
+    val["BORDER_COLOR"] = "#555555"
+    val["ACTIVE_BORDER_COLOR"] = "#4C837E"
+    val["BUTTON_COLOR"] = "#e8e4cf"
+    val["TEXT_COLOR"] = "#FFFFFF"
+    val["LINE_COLOR"] = "#FFFFFF"
+    val["HIGHLIGHT_COLOR"] = "#6CA39E"
+    val["FONT"] = "fixed"
+    val["MOUSE_MOD"] = "Mod1"
+    val["BORDER_WIDTH"] = 1
+    val["WORKSPACES"] = 4
+    val["BAR_RATE"] = 10
+    val["ALTTAB_PREVIEW"] = 0
+    val["PREVIEW_INTERVAL"] = 5
+    val["PREVIEW_MEMORY"] = 8192
+    nbinds = 0
+    nrules = 0
+    nstatus = 0
+    n = split("clock mem cpu load battery cmd fifo root", a, " ")
+    for (i = 1; i <= n; i++) modules[a[i]] = 1
+}
+
+/^#/ || NF == 0 { next }
+
+$1 == "BIND" && NF >= 4 {
+    cmd = $0
+    sub(/^[ \t]*BIND[ \t]+[^ \t]+[ \t]+[^ \t]+[ \t]+/, "", cmd)
+    sub(/\t.*$/, "", cmd)
+    bmod[nbinds] = modmask($2)
+    bkey[nbinds] = "XK_" $3
+    bcmd[nbinds] = cmd
+    nbinds++
+    next
+}
+
+$1 == "RULE" && NF >= 4 {
+    r = "{ .class = " cstr($2) ", .instance = " cstr($3) ", .title = " cstr($4)
+    mon = -1; ws = -1
+    for (i = 5; i <= NF; i++) {
+        if ($i ~ /^monitor=/) mon = substr($i, 9) - 1
+        else if ($i ~ /^workspace=/) ws = substr($i, 11) - 1
+        else if ($i ~ /^geometry=/) {
+            g = substr($i, 10)
+            if (match(g, /^[0-9]+x[0-9]+/)) {
+                split(substr(g, 1, RLENGTH), wh, "x")
+                r = r ", .w = " (wh[1] + 0) ", .h = " (wh[2] + 0)
+                g = substr(g, RLENGTH + 1)
+                if (match(g, /^[-+][0-9]+[-+][0-9]+$/)) {
+                    match(g, /^[-+][0-9]+/)
+                    r = r ", .x = " (substr(g, 1, RLENGTH) + 0) ", .y = " (substr(g, RLENGTH + 1) + 0) ", .has_pos = 1"
+                }
+            }
+        }
+        else if ($i == "fullscreen") r = r ", .fullscreen = 1"
+        else if ($i == "hidden") r = r ", .hidden = 1"
+    }
+    rules[nrules++] = r ", .monitor = " mon ", .workspace = " ws " }"
+    next
+}
+
+$1 == "STATUS" && NF >= 2 && (tolower($2) in modules) {
+    arg = $0
+    sub(/^[ \t]*STATUS[ \t]+[^ \t]+[ \t]*/, "", arg)
+    iv = 0
+    if ($3 ~ /^[0-9]+$/) {
+        iv = $3 + 0
+        sub(/^[^ \t]+[ \t]*/, "", arg)
+    }
+    if (iv < 100) iv = 100
+    if (nstatus < 16) status[nstatus++] = "{ STATUS_" toupper($2) ", " iv ", " cstr(arg) " }"
+    next
+}
+
+$1 == "FONT" && NF >= 2 {
+    font = $0
+    sub(/^[ \t]*FONT[ \t]+/, "", font)
+    sub(/\t.*$/, "", font)
+    val["FONT"] = font
+    next
+}
+
+NF >= 2 && ($1 in val) { val[$1] = $2 }
+
+END {
+    mouse = modmask(val["MOUSE_MOD"])
+    if (mouse == "0") mouse = "Mod1Mask"
+
+    print "/* Generated from " FILENAME " by genconfig.awk, do not edit. */"
+    print ""
+    print "static const struct Config static_conf = {"
+    n = split(keys, k, " ")
+    for (i = 1; i <= n; i++) print "    " cstr(val[k[i]]) ","
+    print "    " (val["BORDER_WIDTH"] + 0) ","
+    print "    " (val["WORKSPACES"] + 0) ","
+    print "    " (val["BAR_RATE"] + 0) ","
+    print "    " (val["ALTTAB_PREVIEW"] + 0) ","
+    print "    " (val["PREVIEW_INTERVAL"] + 0) ","
+    print "    " (val["PREVIEW_MEMORY"] + 0) ","
+    if (!nstatus) {
+        status[nstatus++] = "{ STATUS_CLOCK, 1000, \"%H:%M | %d/%m\" }"
+        status[nstatus++] = "{ STATUS_MEM, 2000, \"\" }"
+    }
+    print "    {"
+    for (i = 0; i < nstatus; i++) print "        " status[i] ","
+    print "    },"
+    print "    " nstatus ","
+    print "};"
+    print ""
+    print "static const unsigned int static_mouse_mod = " mouse ";"
+    print ""
+    print "static const KeyBind static_binds[] = {"
+    for (i = 0; i < nbinds; i++)
+        print "    { " bmod[i] ", " bkey[i] ", " cstr(bcmd[i]) ", " action(bcmd[i]) " },"
+    print "};"
+    print ""
+    print "static const int static_rule_count = " nrules ";"
+    print "static const Rule static_rules[" (nrules ? nrules : 1) "] = {"
+    for (i = 0; i < nrules; i++) print "    " rules[i] ","
+    if (!nrules) print "    { .monitor = -1, .workspace = -1 },"
+    print "};"
+}
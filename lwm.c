@@ -1,19 +1,74 @@
+#define _GNU_SOURCE
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <X11/Xatom.h>
 #include <X11/keysym.h>
 #include <X11/cursorfont.h>
 #include <X11/extensions/Xinerama.h>
+#include <X11/extensions/Xrandr.h>
+#include <X11/extensions/XShm.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef HAVE_XFT
+#include <X11/Xft/Xft.h>
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <signal.h>
 #include <string.h>
+#include <limits.h>
 #include <time.h>
-#include <sys/sysinfo.h>
 #include <sys/select.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <errno.h>
+#include <stdarg.h>
 #include <strings.h>
+#include <ctype.h>
+#include <fnmatch.h>
+
+#ifdef LWM_ALLOC_CHECK
+__thread unsigned long alloc_count = 0;
+
+void *check_malloc(size_t n) { alloc_count++; return malloc(n); }
+void *check_calloc(size_t n, size_t m) { alloc_count++; return calloc(n, m); }
+void *check_realloc(void *p, size_t n) { alloc_count++; return realloc(p, n); }
+char *check_strdup(const char *s) { alloc_count++; return strdup(s); }
+
+#define malloc(n)     check_malloc(n)
+#define calloc(n, m)  check_calloc(n, m)
+#define realloc(p, n) check_realloc(p, n)
+#define strdup(s)     check_strdup(s)
+
+int alloc_event = 0;
+unsigned long alloc_mark = 0;
+
+void alloc_watch(int type) {
+    if (alloc_event && alloc_count != alloc_mark) {
+        if (alloc_event == LASTEvent) {
+            fprintf(stderr, "lwm: %lu heap allocations in the batch flush\n", alloc_count - alloc_mark);
+        } else {
+            fprintf(stderr, "lwm: %lu heap allocations while handling event %d\n",
+                    alloc_count - alloc_mark, alloc_event);
+        }
+        abort();
+    }
+    alloc_event = (type == MotionNotify || type == EnterNotify || type == FocusIn ||
+                   type == FocusOut || type == Expose || type == LASTEvent) ? type : 0;
+    alloc_mark = alloc_count;
+}
+#endif
 
 enum {
     NET_SUPPORTED,
@@ -32,13 +87,53 @@ enum {
     NET_WM_WINDOW_TYPE_SPLASH,
     NET_WM_WINDOW_TYPE_UTILITY,
     NET_WM_WINDOW_TYPE_NOTIFICATION,
+    NET_WM_PING,
+    NET_WM_PID,
+    NET_NUMBER_OF_DESKTOPS,
+    NET_CURRENT_DESKTOP,
+    NET_WM_DESKTOP,
+    NET_WM_ICON,
     WM_PROTOCOLS,
     WM_DELETE_WINDOW,
+    WM_STATE,
+    WM_CHANGE_STATE,
+    WM_WINDOW_ROLE,
     ATOM_LAST
 };
 
 Atom wmatoms[ATOM_LAST];
 
+enum {
+    STATUS_CLOCK,
+    STATUS_MEM,
+    STATUS_CPU,
+    STATUS_LOAD,
+    STATUS_BATTERY,
+    STATUS_CMD,
+    STATUS_FIFO,
+    STATUS_ROOT,
+    STATUS_LAST
+};
+
+const char *status_names[STATUS_LAST] = {
+    [STATUS_CLOCK] = "clock",
+    [STATUS_MEM] = "mem",
+    [STATUS_CPU] = "cpu",
+    [STATUS_LOAD] = "load",
+    [STATUS_BATTERY] = "battery",
+    [STATUS_CMD] = "cmd",
+    [STATUS_FIFO] = "fifo",
+    [STATUS_ROOT] = "root",
+};
+
+typedef struct {
+    int type;
+    int interval;
+    char arg[128];
+} StatusSpec;
+
+#define MAX_STATUS 16
+
 struct Config {
     char bar_color[16];
     char bg_color[16];
@@ -51,59 +146,400 @@ struct Config {
     char font_name[64];
     char mouse_mod[16];
     int border_width;
+    int workspaces;
+    int bar_rate;
+    int preview;
+    int preview_interval;
+    int preview_memory;
+    StatusSpec status[MAX_STATUS];
+    int status_count;
 } conf;
 
+enum {
+    ACT_SPAWN,
+    ACT_QUIT,
+    ACT_RESTART,
+    ACT_ALTTAB,
+    ACT_MENU,
+    ACT_UNHIDE,
+    ACT_CLOSE,
+    ACT_FULLSCREEN,
+    ACT_SNAP_LEFT,
+    ACT_SNAP_RIGHT,
+    ACT_MAXIMIZE,
+    ACT_RESTORE,
+    ACT_WORKSPACE,
+    ACT_MOVE_TO,
+    ACT_TILE,
+    ACT_GRID,
+    ACT_FLOAT,
+    ACT_LAST
+};
+
+const char *action_names[ACT_LAST] = {
+    [ACT_QUIT] = "quit",
+    [ACT_RESTART] = "restart",
+    [ACT_ALTTAB] = "alttab",
+    [ACT_MENU] = "menu",
+    [ACT_UNHIDE] = "unhide",
+    [ACT_CLOSE] = "close",
+    [ACT_FULLSCREEN] = "fullscreen",
+    [ACT_SNAP_LEFT] = "snap_left",
+    [ACT_SNAP_RIGHT] = "snap_right",
+    [ACT_MAXIMIZE] = "maximize",
+    [ACT_RESTORE] = "restore",
+    [ACT_WORKSPACE] = "workspace",
+    [ACT_MOVE_TO] = "move_to",
+    [ACT_TILE] = "tile",
+    [ACT_GRID] = "grid",
+    [ACT_FLOAT] = "float",
+};
+
 typedef struct {
     unsigned int mod;
     KeySym key;
     char command[128];
+    int action;
+    int arg;
 } KeyBind;
 
-KeyBind binds[128];
+#define MAX_BINDS 128
+
+KeyBind binds[MAX_BINDS];
 int bind_count = 0;
 unsigned int mouse_mod_mask = Mod1Mask;
 
+typedef struct {
+    char class[64];
+    char instance[64];
+    char title[64];
+    int monitor;
+    int workspace;
+    int x, y, w, h;
+    int has_pos;
+    int fullscreen;
+    int hidden;
+    unsigned int hash;
+    int next;
+} Rule;
+
+#define MAX_RULES    512
+#define RULE_BUCKETS 256
+
+typedef struct {
+    Rule rules[MAX_RULES];
+    int count;
+    int bucket[RULE_BUCKETS];
+    int wild[MAX_RULES];
+    int wild_count;
+} RuleSet;
+
+RuleSet ruleset;
+
+struct Pixels {
+    unsigned long bar;
+    unsigned long bg;
+    unsigned long border;
+    unsigned long active_border;
+    unsigned long button;
+    unsigned long text;
+    unsigned long line;
+    unsigned long highlight;
+    unsigned long dim;
+} px;
+
+int config_watch_fd = -1;
+
+#ifdef STATIC_CONFIG
+#include "config.h"
+#endif
+
 #define CLEANMASK(mask) (mask & (Mod1Mask | Mod4Mask | ShiftMask | ControlMask))
 
 #define TITLE_HEIGHT           26
 #define BAR_HEIGHT             26
 #define MENU_ITEM_H            36
 #define MIN_SIZE               60
+#define MAX_WORKSPACES         16
+#define MASTER_RATIO           55
 #define MAX_CLIENTS            256
-#define MAX_MONITORS           8
 #define DEFAULT_WINDOW_WIDTH   800
 #define DEFAULT_WINDOW_HEIGHT  500
 #define BUTTON_PADDING         8
 #define ALT_TAB_WIDTH          500
 #define ALT_TAB_ITEM_H         44
 #define ALT_TAB_PADDING        6
+#define ALT_TAB_QUERY_H        (ALT_TAB_ITEM_H / 2)
+#define GRID_CELL              256
+#define GRID_CELL_CAP          8
+#define BATCH_ARENA_SIZE       (128 << 10)
+#define ALT_TAB_ARENA_SIZE     (MAX_CLIENTS * 1024)
+#define MENU_ARENA_SIZE        (64 << 10)
+#define ARENA_ALIGN            16
+#define SNAP_DIST              12
+#define PLACE_CANDIDATES       64
+#define PING_TIMEOUT_MS        3000
+#define STATUS_MIN_MS          100
+#define STATUS_FIFO_READ       4096
+#define ICON_SIZES             2
+#define ICON_TITLE             0
+#define ICON_ALTTAB            1
+#define ICON_QUEUE             512
+#define ICON_MAX_DATA          (1 << 20)
+#define THUMB_W                160
+#define THUMB_H                100
+#define THUMB_MAX_SRC          8192
+#define THUMB_STRIP_BYTES      (1 << 21)
+#define ALT_TAB_CELL_W         (THUMB_W + ALT_TAB_PADDING * 2)
+#define ALT_TAB_CELL_H         (THUMB_H + ALT_TAB_PADDING * 2 + ALT_TAB_ITEM_H / 2)
+#define TITLE_RATE             4
+#define TITLE_BURST            3
+#define TITLE_COST_MS          (1000 / TITLE_RATE)
+
+#define CLIENT_EVENT_MASK      (PropertyChangeMask)
+#define ROOT_EVENT_MASK        (SubstructureRedirectMask | SubstructureNotifyMask | \
+                                KeyPressMask | KeyReleaseMask)
+#define FRAME_EVENT_MASK       (SubstructureRedirectMask | SubstructureNotifyMask | \
+                                ButtonPressMask | ButtonReleaseMask | ExposureMask | \
+                                EnterWindowMask)
+
+#define PROTO_DELETE           (1 << 0)
+#define PROTO_PING             (1 << 1)
+#define DUE_TITLE              (1 << 0)
+#define DUE_PING               (1 << 1)
+#define DUE_SESSION            (1 << 2)
 
 typedef struct {
     int x, y, w, h;
     Window bar_win;
+    int workspace;
+    int layout;
+    int dirty;
+    Window fullscreen;
+    int status_x;
 } Monitor;
 
-Monitor monitors[MAX_MONITORS];
+enum { LAYOUT_FLOAT, LAYOUT_TILE, LAYOUT_GRID };
+
+Monitor *monitors = NULL;
 int monitor_count = 0;
+int randr_event_base = -1;
 
 Display *dpy;
 Window root;
 Window check_win;
 XFontStruct *font_info;
+int glyph_w[256];
+int ellipsis_w = 0;
+
+#ifdef HAVE_XFT
+#define XFT_ADV_CACHE 4096
+#define XFT_COLORS    16
+
+XftFont *xft_font = NULL;
+XftDraw *xft_draw = NULL;
+short xft_adv[XFT_ADV_CACHE];
+
+struct {
+    unsigned long pixel;
+    XftColor color;
+} xft_colors[XFT_COLORS];
+int xft_color_count = 0;
+#endif
 Window focus_window = 0;
 int running = 1;
+int restarting = 0;
 int active_monitor = 0;
+char **saved_argv;
+
+typedef struct {
+    int used;
+    unsigned int protocols;
+    int protocols_valid;
+    pid_t pid;
+    long long ping_deadline;
+    int unresponsive;
+    int ignore_unmap;
+    int session_slot;
+    char title[256];
+    char wm_class[64];
+    long long title_due;
+    long long title_refill;
+    int title_credit;
+    unsigned int title_coalesced;
+    char title_fit[256];
+    int title_fit_len;
+    int title_fit_w;
+    unsigned int *icon[ICON_SIZES];
+    Pixmap icon_pix[ICON_SIZES];
+    unsigned long icon_bg[ICON_SIZES];
+    int icon_valid[ICON_SIZES];
+    int icon_busy;
+    int icon_stale;
+    Pixmap thumb_pix;
+    int thumb_w, thumb_h;
+    int thumb_busy;
+    long long thumb_time;
+#ifdef HAVE_XFT
+    Pixmap title_pix;
+    int title_pix_w;
+    int title_pix_valid;
+    unsigned long title_pix_fg, title_pix_bg;
+#endif
+    int indexed;
+    int ix, iy, iw, ih;
+    int pending_x, pending_y, pending_w, pending_h;
+    int old_x, old_y, old_w, old_h;
+} ClientCold;
 
 typedef struct {
     Window frame;
     Window client;
-    int is_fullscreen;
+    unsigned long last_focus;
+    unsigned long tile_order;
+    int x, y, w, h;
     int monitor;
-    XWindowAttributes old_attr;
+    int workspace;
+    unsigned char is_fullscreen;
+    unsigned char is_hidden;
+    unsigned char ws_hidden;
+    unsigned char pending_configure;
+    unsigned char deco_dirty;
+    unsigned char due;
+    unsigned short cold;
 } ClientState;
 
 ClientState clients[MAX_CLIENTS];
+ClientCold client_cold[MAX_CLIENTS];
 int client_count = 0;
+unsigned long focus_serial = 0;
+unsigned long tile_serial = 0;
+
+ClientCold *cold(ClientState *cs) {
+    return &client_cold[cs->cold];
+}
+unsigned int titles_coalesced = 0;
+int thumb_count = 0;
+long thumb_bytes = 0;
+long thumb_shm_bytes = 0;
+
+#define RESTART_MAGIC   0x6c776d72
+#define RESTART_VERSION 4
+#define RESTART_ENV     "LWM_RESTART_FD"
+
+#define SESSION_MAGIC   0x6c776d73
+#define SESSION_VERSION 1
+#define SESSION_SLOTS   512
+#define SESSION_PROBE   16
+
+typedef struct {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int record_size;
+    unsigned int slots;
+    unsigned long long clock;
+} SessionHeader;
+
+typedef struct {
+    unsigned int seq;
+    unsigned int hash;
+    unsigned long long used;
+    char key[128];
+    int x, y, w, h;
+    int workspace;
+    int fullscreen;
+    int hidden;
+    int pad;
+} SessionRecord;
+
+SessionHeader *session_hdr = NULL;
+SessionRecord *session_recs = NULL;
+size_t session_size = 0;
+
+#define SNAPSHOT_MAGIC    0x6c776d77
+#define SNAPSHOT_VERSION  3
+#define SNAPSHOT_MONITORS 32
+
+typedef struct {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int seq;
+    unsigned int header_size;
+    unsigned int client_size;
+    unsigned int monitor_size;
+    unsigned int max_clients;
+    unsigned int max_monitors;
+    unsigned int client_count;
+    unsigned int monitor_count;
+    int active_monitor;
+    unsigned int titles_coalesced;
+    unsigned int thumb_count;
+    unsigned int thumb_bytes;
+    unsigned long focus;
+} SnapshotHeader;
+
+typedef struct {
+    unsigned long client;
+    unsigned long frame;
+    unsigned long last_focus;
+    int x, y, w, h;
+    int monitor;
+    int workspace;
+    int hidden;
+    int fullscreen;
+    unsigned int title_coalesced;
+    int pad;
+    char title[256];
+} SnapshotClient;
+
+typedef struct {
+    int x, y, w, h;
+    int workspace;
+    int layout;
+    unsigned long fullscreen;
+} SnapshotMonitor;
+
+SnapshotHeader *snapshot_hdr = NULL;
+size_t snapshot_size = 0;
+char snapshot_path[128];
+int snapshot_dirty = 1;
+
+typedef struct {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int count;
+    unsigned int monitors;
+    Window focus;
+} RestartHeader;
+
+typedef struct {
+    Window frame;
+    Window client;
+    int x, y, w, h;
+    int old_x, old_y, old_w, old_h;
+    int monitor;
+    int is_fullscreen;
+    int is_hidden;
+    int workspace;
+    int ws_hidden;
+    unsigned long last_focus;
+    unsigned long tile_order;
+    unsigned int protocols;
+    int protocols_valid;
+    int pid;
+    char title[256];
+    char wm_class[64];
+    char session_key[128];
+} RestartRecord;
+
+typedef struct {
+    int workspace;
+    int layout;
+} RestartMonitor;
+
+Window trapped_errors[MAX_CLIENTS];
+int trapped_count = 0;
+int trap_errors = 0;
 
 typedef struct {
     int start_root_x, start_root_y;
@@ -127,6 +563,16 @@ typedef struct {
     GC gc;
     int active;
     int keyboard_grabbed;
+    int width, height;
+    int cols, rows, top;
+    char **hay;
+    int *pos;
+    int *vis;
+    int nvis;
+    int *shown;
+    int shown_sel;
+    char query[64];
+    int qlen;
 } AltTabState;
 
 AltTabState alt_tab = {0};
@@ -140,6 +586,30 @@ unsigned long get_pixel(const char *color_hex) {
     return color.pixel;
 }
 
+int clamp_workspaces(int n) {
+    if (n < 1) return 1;
+    if (n > MAX_WORKSPACES) return MAX_WORKSPACES;
+    return n;
+}
+
+int parse_action(const char *cmd, int *arg) {
+    char name[32];
+    int n = 0, consumed = 0;
+
+    *arg = 0;
+    if (sscanf(cmd, "%31s %n%d %n", name, &consumed, &n, &consumed) < 1) return ACT_SPAWN;
+    if (cmd[consumed] != '\0') return ACT_SPAWN;
+
+    for (int i = 0; i < ACT_LAST; i++) {
+        if (!action_names[i] || strcasecmp(name, action_names[i]) != 0) continue;
+        int wants_arg = (i == ACT_WORKSPACE || i == ACT_MOVE_TO);
+        if (wants_arg != (n > 0)) return ACT_SPAWN;
+        *arg = n;
+        return i;
+    }
+    return ACT_SPAWN;
+}
+
 unsigned int str_to_mod(const char *str) {
     unsigned int mod = 0;
     if (!str) return 0;
@@ -150,7 +620,335 @@ unsigned int str_to_mod(const char *str) {
     return mod;
 }
 
+typedef struct {
+    char *base;
+    size_t size;
+    size_t used;
+} Arena;
+
+Arena batch_arena, alt_tab_arena, menu_arena;
+
+void arena_init(Arena *a, size_t size) {
+    a->base = malloc(size);
+    a->size = a->base ? size : 0;
+    a->used = 0;
+}
+
+void arena_reset(Arena *a) {
+    a->used = 0;
+}
+
+void *arena_alloc(Arena *a, size_t n) {
+    n = (n + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (a->size - a->used < n) return NULL;
+    void *p = a->base + a->used;
+    a->used += n;
+    return p;
+}
+
+void *arena_calloc(Arena *a, size_t n, size_t size) {
+    void *p = arena_alloc(a, n * size);
+    if (p) memset(p, 0, n * size);
+    return p;
+}
+
+char *arena_strdup(Arena *a, const char *str) {
+    size_t n = strlen(str) + 1;
+    char *p = arena_alloc(a, n);
+    if (p) memcpy(p, str, n);
+    return p;
+}
+
+typedef struct {
+    Window frame;
+    int x, y, w, h;
+} GridEntry;
+
+typedef struct {
+    GridEntry *items;
+    int count;
+    int monitor;
+} GridCell;
+
+struct {
+    GridCell *cells;
+    GridEntry *pool;
+    int cap;
+    int cols, rows;
+    int ox, oy;
+} grid;
+
+int grid_col(int x) {
+    int c = (x - grid.ox) / GRID_CELL;
+    if (x < grid.ox) c = 0;
+    return c >= grid.cols ? grid.cols - 1 : c;
+}
+
+int grid_row(int y) {
+    int r = (y - grid.oy) / GRID_CELL;
+    if (y < grid.oy) r = 0;
+    return r >= grid.rows ? grid.rows - 1 : r;
+}
+
+void grid_free(void) {
+    free(grid.cells);
+    free(grid.pool);
+    memset(&grid, 0, sizeof(grid));
+}
+
+void grid_init(void) {
+    grid_free();
+    if (monitor_count == 0) return;
+
+    int x0 = monitors[0].x, y0 = monitors[0].y;
+    int x1 = x0 + monitors[0].w, y1 = y0 + monitors[0].h;
+    for (int i = 1; i < monitor_count; i++) {
+        if (monitors[i].x < x0) x0 = monitors[i].x;
+        if (monitors[i].y < y0) y0 = monitors[i].y;
+        if (monitors[i].x + monitors[i].w > x1) x1 = monitors[i].x + monitors[i].w;
+        if (monitors[i].y + monitors[i].h > y1) y1 = monitors[i].y + monitors[i].h;
+    }
+
+    grid.ox = x0;
+    grid.oy = y0;
+    grid.cols = (x1 - x0 + GRID_CELL - 1) / GRID_CELL;
+    grid.rows = (y1 - y0 + GRID_CELL - 1) / GRID_CELL;
+    if (grid.cols < 1) grid.cols = 1;
+    if (grid.rows < 1) grid.rows = 1;
+    grid.cap = GRID_CELL_CAP;
+    while (grid.cap < client_count && grid.cap < MAX_CLIENTS) grid.cap *= 2;
+    grid.cells = calloc(grid.cols * grid.rows, sizeof(GridCell));
+    grid.pool = calloc(grid.cols * grid.rows * grid.cap, sizeof(GridEntry));
+    if (!grid.cells || !grid.pool) {
+        free(grid.cells);
+        free(grid.pool);
+        grid.cells = NULL;
+        grid.pool = NULL;
+        grid.cols = grid.rows = 0;
+        return;
+    }
+
+    for (int r = 0; r < grid.rows; r++) {
+        for (int c = 0; c < grid.cols; c++) {
+            int cx = grid.ox + c * GRID_CELL, cy = grid.oy + r * GRID_CELL;
+            GridCell *cell = &grid.cells[r * grid.cols + c];
+            cell->items = grid.pool + (r * grid.cols + c) * grid.cap;
+            cell->monitor = -1;
+            for (int i = 0; i < monitor_count; i++) {
+                if (cx >= monitors[i].x && cx + GRID_CELL <= monitors[i].x + monitors[i].w &&
+                    cy >= monitors[i].y && cy + GRID_CELL <= monitors[i].y + monitors[i].h) {
+                    cell->monitor = i;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+void grid_reserve(int n) {
+    if (!grid.cells || n <= grid.cap) return;
+    int cap = grid.cap;
+    while (cap < n && cap < MAX_CLIENTS) cap *= 2;
+    GridEntry *pool = calloc(grid.cols * grid.rows * cap, sizeof(GridEntry));
+    if (!pool) return;
+    for (int i = 0; i < grid.cols * grid.rows; i++) {
+        memcpy(pool + i * cap, grid.cells[i].items, sizeof(GridEntry) * grid.cells[i].count);
+        grid.cells[i].items = pool + i * cap;
+    }
+    free(grid.pool);
+    grid.pool = pool;
+    grid.cap = cap;
+}
+
+void grid_insert(Window frame, int x, int y, int w, int h) {
+    if (!grid.cells) return;
+    for (int r = grid_row(y); r <= grid_row(y + h - 1); r++) {
+        for (int c = grid_col(x); c <= grid_col(x + w - 1); c++) {
+            GridCell *cell = &grid.cells[r * grid.cols + c];
+            if (cell->count < grid.cap) cell->items[cell->count++] = (GridEntry){ frame, x, y, w, h };
+        }
+    }
+}
+
+void grid_remove(Window frame, int x, int y, int w, int h) {
+    if (!grid.cells) return;
+    for (int r = grid_row(y); r <= grid_row(y + h - 1); r++) {
+        for (int c = grid_col(x); c <= grid_col(x + w - 1); c++) {
+            GridCell *cell = &grid.cells[r * grid.cols + c];
+            for (int i = 0; i < cell->count; i++) {
+                if (cell->items[i].frame == frame) {
+                    cell->items[i] = cell->items[--cell->count];
+                    break;
+                }
+            }
+        }
+    }
+}
+
+int on_current_workspace(ClientState *cs) {
+    if (cs->monitor < 0 || cs->monitor >= monitor_count) return 1;
+    return cs->workspace == monitors[cs->monitor].workspace;
+}
+
+int client_visible(ClientState *cs) {
+    return !cs->is_hidden && on_current_workspace(cs);
+}
+
+void grid_update(ClientState *cs) {
+    ClientCold *cc = cold(cs);
+    int bw2 = conf.border_width * 2;
+    int want = cs->frame && client_visible(cs) && cs->w > 0 && cs->h > 0;
+
+    if (cc->indexed) {
+        if (want && cc->ix == cs->x && cc->iy == cs->y &&
+            cc->iw == cs->w + bw2 && cc->ih == cs->h + bw2) return;
+        grid_remove(cs->frame, cc->ix, cc->iy, cc->iw, cc->ih);
+        cc->indexed = 0;
+    }
+    if (!want) return;
+
+    cc->ix = cs->x;
+    cc->iy = cs->y;
+    cc->iw = cs->w + bw2;
+    cc->ih = cs->h + bw2;
+    grid_insert(cs->frame, cc->ix, cc->iy, cc->iw, cc->ih);
+    cc->indexed = 1;
+}
+
+int grid_collect(int x, int y, int w, int h, GridEntry *out) {
+    int c0 = grid_col(x), c1 = grid_col(x + w - 1);
+    int r0 = grid_row(y), r1 = grid_row(y + h - 1);
+    int n = 0;
+
+    for (int r = r0; r <= r1; r++) {
+        for (int c = c0; c <= c1; c++) {
+            GridCell *cell = &grid.cells[r * grid.cols + c];
+            for (int i = 0; i < cell->count; i++) {
+                GridEntry *e = &cell->items[i];
+                if (grid_col(x > e->x ? x : e->x) != c || grid_row(y > e->y ? y : e->y) != r) continue;
+                out[n++] = *e;
+            }
+        }
+    }
+    return n;
+}
+
+int grid_overlap(Window self, int x, int y, int w, int h) {
+    GridEntry near[MAX_CLIENTS];
+    long long area = 0;
+    if (!grid.cells) return 0;
+
+    int n = grid_collect(x, y, w, h, near);
+    for (int i = 0; i < n; i++) {
+        GridEntry *e = &near[i];
+        if (e->frame == self) continue;
+        int ix0 = x > e->x ? x : e->x;
+        int iy0 = y > e->y ? y : e->y;
+        int ix1 = (x + w < e->x + e->w) ? x + w : e->x + e->w;
+        int iy1 = (y + h < e->y + e->h) ? y + h : e->y + e->h;
+        if (ix1 <= ix0 || iy1 <= iy0) continue;
+        area += (long long)(ix1 - ix0) * (iy1 - iy0);
+    }
+    return area > 0x7fffffff ? 0x7fffffff : (int)area;
+}
+
+void place_window(int mon, int w, int h, int *out_x, int *out_y) {
+    int mx = monitors[mon].x;
+    int my = monitors[mon].y + BAR_HEIGHT;
+    int mw = monitors[mon].w;
+    int mh = monitors[mon].h - BAR_HEIGHT;
+
+    int cand_x[PLACE_CANDIDATES], cand_y[PLACE_CANDIDATES];
+    int n = 0;
+
+    cand_x[n] = mx + (mw - w) / 2;
+    cand_y[n] = my + (mh - h) / 2;
+    if (cand_y[n] < my) cand_y[n] = my;
+    n++;
+    cand_x[n] = mx;          cand_y[n] = my;          n++;
+    cand_x[n] = mx + mw - w; cand_y[n] = my;          n++;
+    cand_x[n] = mx;          cand_y[n] = my + mh - h; n++;
+    cand_x[n] = mx + mw - w; cand_y[n] = my + mh - h; n++;
+
+    if (grid.cells) {
+        GridEntry near[MAX_CLIENTS];
+        int count = grid_collect(mx, my, mw, mh, near);
+        for (int i = 0; i < count && n + 2 <= PLACE_CANDIDATES; i++) {
+            GridEntry *e = &near[i];
+            if (grid_col(e->x) < grid_col(mx) || grid_row(e->y) < grid_row(my)) continue;
+            cand_x[n] = e->x + e->w; cand_y[n] = e->y;        n++;
+            cand_x[n] = e->x;        cand_y[n] = e->y + e->h; n++;
+        }
+    }
+
+    int best = 0, best_overlap = -1;
+    for (int i = 0; i < n; i++) {
+        int x = cand_x[i], y = cand_y[i];
+        if (i > 0 && (x < mx || y < my || x + w > mx + mw || y + h > my + mh)) continue;
+        int overlap = grid_overlap(0, x, y, w, h);
+        if (best_overlap < 0 || overlap < best_overlap) {
+            best = i;
+            best_overlap = overlap;
+            if (overlap == 0) break;
+        }
+    }
+
+    *out_x = cand_x[best];
+    *out_y = cand_y[best];
+}
+
+int snap_edge(int pos, int size, int lo, int hi, int *best) {
+    int d;
+    d = lo - pos;          if (abs(d) < abs(*best)) *best = d;
+    d = hi - pos;          if (abs(d) < abs(*best)) *best = d;
+    d = lo - (pos + size); if (abs(d) < abs(*best)) *best = d;
+    d = hi - (pos + size); if (abs(d) < abs(*best)) *best = d;
+    return *best;
+}
+
+void snap_position(ClientState *cs, int *x, int *y) {
+    int w = cs->w + conf.border_width * 2;
+    int h = cs->h + conf.border_width * 2;
+    int dx = SNAP_DIST + 1, dy = SNAP_DIST + 1;
+
+    for (int i = 0; i < monitor_count; i++) {
+        Monitor *m = &monitors[i];
+        if (*y + h >= m->y && *y <= m->y + m->h) {
+            snap_edge(*x, w, m->x, m->x + m->w, &dx);
+        }
+        if (*x + w >= m->x && *x <= m->x + m->w) {
+            snap_edge(*y, h, m->y + BAR_HEIGHT, m->y + m->h, &dy);
+        }
+    }
+
+    if (grid.cells) {
+        int qx = *x - SNAP_DIST, qy = *y - SNAP_DIST;
+        int qw = w + SNAP_DIST * 2, qh = h + SNAP_DIST * 2;
+        GridEntry near[MAX_CLIENTS];
+        int n = grid_collect(qx, qy, qw, qh, near);
+        for (int i = 0; i < n; i++) {
+            GridEntry *e = &near[i];
+            if (e->frame == cs->frame) continue;
+            if (*y + h >= e->y && *y <= e->y + e->h) {
+                snap_edge(*x, w, e->x, e->x + e->w, &dx);
+            }
+            if (*x + w >= e->x && *x <= e->x + e->w) {
+                snap_edge(*y, h, e->y, e->y + e->h, &dy);
+            }
+        }
+    }
+
+    if (abs(dx) <= SNAP_DIST) *x += dx;
+    if (abs(dy) <= SNAP_DIST) *y += dy;
+}
+
 int get_monitor_at(int x, int y) {
+    if (grid.cells && x >= grid.ox && y >= grid.oy) {
+        int c = (x - grid.ox) / GRID_CELL, r = (y - grid.oy) / GRID_CELL;
+        if (c < grid.cols && r < grid.rows && grid.cells[r * grid.cols + c].monitor >= 0) {
+            return grid.cells[r * grid.cols + c].monitor;
+        }
+    }
     for (int i = 0; i < monitor_count; i++) {
         if (x >= monitors[i].x && x < monitors[i].x + monitors[i].w &&
             y >= monitors[i].y && y < monitors[i].y + monitors[i].h) {
@@ -168,43 +966,64 @@ int get_monitor_for_window(Window win) {
     return get_monitor_at(cx, cy);
 }
 
-void detect_monitors(void) {
-    monitor_count = 0;
-    
+int query_monitors(Monitor **out) {
+    Monitor *mons = NULL;
+    int count = 0;
+
     if (XineramaIsActive(dpy)) {
-        int count;
-        XineramaScreenInfo *info = XineramaQueryScreens(dpy, &count);
+        int n;
+        XineramaScreenInfo *info = XineramaQueryScreens(dpy, &n);
         if (info) {
-            for (int i = 0; i < count && i < MAX_MONITORS; i++) {
-                monitors[i].x = info[i].x_org;
-                monitors[i].y = info[i].y_org;
-                monitors[i].w = info[i].width;
-                monitors[i].h = info[i].height;
-                monitors[i].bar_win = 0;
-                monitor_count++;
+            mons = calloc(n, sizeof(Monitor));
+            for (int i = 0; mons && i < n; i++) {
+                int dup = 0;
+                for (int j = 0; j < count; j++) {
+                    if (mons[j].x == info[i].x_org && mons[j].y == info[i].y_org &&
+                        mons[j].w == info[i].width && mons[j].h == info[i].height) {
+                        dup = 1;
+                        break;
+                    }
+                }
+                if (dup) continue;
+                mons[count].x = info[i].x_org;
+                mons[count].y = info[i].y_org;
+                mons[count].w = info[i].width;
+                mons[count].h = info[i].height;
+                count++;
             }
             XFree(info);
         }
     }
-    
-    if (monitor_count == 0) {
-        monitors[0].x = 0;
-        monitors[0].y = 0;
-        monitors[0].w = DisplayWidth(dpy, DefaultScreen(dpy));
-        monitors[0].h = DisplayHeight(dpy, DefaultScreen(dpy));
-        monitors[0].bar_win = 0;
-        monitor_count = 1;
+
+    if (count == 0) {
+        free(mons);
+        mons = calloc(1, sizeof(Monitor));
+        if (!mons) return 0;
+        mons[0].w = DisplayWidth(dpy, DefaultScreen(dpy));
+        mons[0].h = DisplayHeight(dpy, DefaultScreen(dpy));
+        count = 1;
     }
+
+    *out = mons;
+    return count;
+}
+
+void detect_monitors(void) {
+    free(monitors);
+    monitors = NULL;
+    monitor_count = query_monitors(&monitors);
+}
+
+void create_bar(Monitor *m) {
+    m->bar_win = XCreateSimpleWindow(dpy, root, m->x, m->y, m->w, BAR_HEIGHT,
+                                     0, 0, px.bar);
+    XSelectInput(dpy, m->bar_win, ExposureMask | ButtonPressMask);
+    XMapWindow(dpy, m->bar_win);
 }
 
 void create_bars(void) {
     for (int i = 0; i < monitor_count; i++) {
-        monitors[i].bar_win = XCreateSimpleWindow(dpy, root,
-            monitors[i].x, monitors[i].y,
-            monitors[i].w, BAR_HEIGHT,
-            0, 0, get_pixel(conf.bar_color));
-        XSelectInput(dpy, monitors[i].bar_win, ExposureMask | ButtonPressMask);
-        XMapWindow(dpy, monitors[i].bar_win);
+        create_bar(&monitors[i]);
     }
 }
 
@@ -224,6 +1043,16 @@ int is_bar_window(Window win) {
     return 0;
 }
 
+void raise_bars(void) {
+    for (int i = 0; i < monitor_count; i++) {
+        if (monitors[i].fullscreen) {
+            XRaiseWindow(dpy, monitors[i].fullscreen);
+        } else if (monitors[i].bar_win) {
+            XRaiseWindow(dpy, monitors[i].bar_win);
+        }
+    }
+}
+
 void create_default_config(const char *path) {
     char dir_path[256];
     const char *home = getenv("HOME");
@@ -246,11 +1075,17 @@ void create_default_config(const char *path) {
     fprintf(f, "FONT                fixed\n");
     fprintf(f, "MOUSE_MOD           Mod1\n");
     fprintf(f, "BORDER_WIDTH        1\n");
+    fprintf(f, "WORKSPACES          4\n");
+    fprintf(f, "BAR_RATE            10\n");
+    fprintf(f, "ALTTAB_PREVIEW      0\n");
+    fprintf(f, "PREVIEW_INTERVAL    5\n");
+    fprintf(f, "PREVIEW_MEMORY      8192\n");
     fprintf(f, "BIND Mod4 Return xterm\n");
     fprintf(f, "BIND Mod4 d dmenu_run\n");
     fprintf(f, "BIND Mod1 Tab alttab\n");
     fprintf(f, "BIND Mod4 Tab menu\n");
     fprintf(f, "BIND Mod4 q quit\n");
+    fprintf(f, "BIND Mod4+Shift r restart\n");
     fprintf(f, "BIND Mod4 c close\n");
     fprintf(f, "BIND Mod4 f fullscreen\n");
     fprintf(f, "BIND Mod4 u unhide\n");
@@ -258,37 +1093,146 @@ void create_default_config(const char *path) {
     fprintf(f, "BIND Mod4 Right snap_right\n");
     fprintf(f, "BIND Mod4 Up maximize\n");
     fprintf(f, "BIND Mod4 Down restore\n");
+    for (int i = 1; i <= 4; i++) {
+        fprintf(f, "BIND Mod4 %d workspace %d\n", i, i);
+        fprintf(f, "BIND Mod4+Shift %d move_to %d\n", i, i);
+    }
+    fprintf(f, "BIND Mod4 t tile\n");
+    fprintf(f, "BIND Mod4 g grid\n");
+    fprintf(f, "BIND Mod4+Shift f float\n");
+    fprintf(f, "\n");
+    fprintf(f, "# STATUS module interval_ms [arg]: clock, mem, cpu, load, battery, cmd\n");
+    fprintf(f, "# STATUS fifo /tmp/lwm.fifo, STATUS root (xsetroot -name)\n");
+    fprintf(f, "STATUS clock 1000 %%H:%%M | %%d/%%m\n");
+    fprintf(f, "STATUS mem 2000\n");
+    fprintf(f, "# STATUS battery 10000 BAT0\n");
+    fprintf(f, "# STATUS cmd 60000 cat /sys/class/thermal/thermal_zone0/temp\n");
+    fprintf(f, "\n");
+    fprintf(f, "# RULE class instance title -> monitor=N workspace=N geometry=WxH+X+Y fullscreen hidden\n");
+    fprintf(f, "# RULE Firefox * * -> workspace=2\n");
 
     fclose(f);
 }
 
-void load_config(void) {
-    strncpy(conf.bar_color, "#4C837E", sizeof(conf.bar_color) - 1);
-    strncpy(conf.bg_color, "#83A597", sizeof(conf.bg_color) - 1);
-    strncpy(conf.border_color, "#555555", sizeof(conf.border_color) - 1);
-    strncpy(conf.active_border_color, "#4C837E", sizeof(conf.active_border_color) - 1);
-    strncpy(conf.button_color, "#e8e4cf", sizeof(conf.button_color) - 1);
-    strncpy(conf.text_color, "#FFFFFF", sizeof(conf.text_color) - 1);
-    strncpy(conf.line_color, "#FFFFFF", sizeof(conf.line_color) - 1);
-    strncpy(conf.highlight_color, "#6CA39E", sizeof(conf.highlight_color) - 1);
-    strncpy(conf.font_name, "fixed", sizeof(conf.font_name) - 1);
-    strncpy(conf.mouse_mod, "Mod1", sizeof(conf.mouse_mod) - 1);
-    conf.border_width = 1;
-
-    char path[256];
+void config_path(char *path, size_t size) {
     const char *home = getenv("HOME");
-    if (!home) return;
-    
-    snprintf(path, sizeof(path), "%s/.config/lwm.conf", home);
+    if (!home) {
+        path[0] = '\0';
+        return;
+    }
+    snprintf(path, size, "%s/.config/lwm.conf", home);
+}
 
-    if (access(path, F_OK) != 0) {
-        create_default_config(path);
+void config_defaults(struct Config *c) {
+    memset(c, 0, sizeof(*c));
+    strncpy(c->bar_color, "#4C837E", sizeof(c->bar_color) - 1);
+    strncpy(c->bg_color, "#83A597", sizeof(c->bg_color) - 1);
+    strncpy(c->border_color, "#555555", sizeof(c->border_color) - 1);
+    strncpy(c->active_border_color, "#4C837E", sizeof(c->active_border_color) - 1);
+    strncpy(c->button_color, "#e8e4cf", sizeof(c->button_color) - 1);
+    strncpy(c->text_color, "#FFFFFF", sizeof(c->text_color) - 1);
+    strncpy(c->line_color, "#FFFFFF", sizeof(c->line_color) - 1);
+    strncpy(c->highlight_color, "#6CA39E", sizeof(c->highlight_color) - 1);
+    strncpy(c->font_name, "fixed", sizeof(c->font_name) - 1);
+    strncpy(c->mouse_mod, "Mod1", sizeof(c->mouse_mod) - 1);
+    c->border_width = 1;
+    c->workspaces = 4;
+    c->bar_rate = 10;
+    c->preview_interval = 5;
+    c->preview_memory = 8192;
+    c->status[0].type = STATUS_CLOCK;
+    c->status[0].interval = 1000;
+    strncpy(c->status[0].arg, "%H:%M | %d/%m", sizeof(c->status[0].arg) - 1);
+    c->status[1].type = STATUS_MEM;
+    c->status[1].interval = 2000;
+    c->status_count = 2;
+}
+
+unsigned int rule_hash(const char *str) {
+    unsigned int h = 2166136261u;
+    while (*str) {
+        h ^= (unsigned char)*str++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+int is_glob(const char *str) {
+    return strpbrk(str, "*?[") != NULL;
+}
+
+void rules_build_index(RuleSet *rs) {
+    for (int i = 0; i < RULE_BUCKETS; i++) rs->bucket[i] = -1;
+    rs->wild_count = 0;
+
+    for (int i = rs->count - 1; i >= 0; i--) {
+        Rule *r = &rs->rules[i];
+        if (is_glob(r->class)) continue;
+        r->hash = rule_hash(r->class);
+        r->next = rs->bucket[r->hash % RULE_BUCKETS];
+        rs->bucket[r->hash % RULE_BUCKETS] = i;
+    }
+    for (int i = 0; i < rs->count; i++) {
+        if (is_glob(rs->rules[i].class)) rs->wild[rs->wild_count++] = i;
+    }
+}
+
+int parse_rule(const char *line, Rule *r) {
+    int n = 0;
+
+    memset(r, 0, sizeof(*r));
+    r->monitor = -1;
+    r->workspace = -1;
+    if (sscanf(line, "RULE %63s %63s %63s %n", r->class, r->instance, r->title, &n) < 3) return 0;
+    if (strncmp(line + n, "->", 2) == 0) n += 2;
+
+    const char *p = line + n;
+    while (*p) {
+        char opt[64];
+        int used = 0;
+        if (sscanf(p, " %63s%n", opt, &used) != 1) break;
+        p += used;
+
+        if (strncmp(opt, "monitor=", 8) == 0) {
+            r->monitor = atoi(opt + 8) - 1;
+        } else if (strncmp(opt, "workspace=", 10) == 0) {
+            r->workspace = atoi(opt + 10) - 1;
+        } else if (strncmp(opt, "geometry=", 9) == 0) {
+            if (sscanf(opt + 9, "%dx%d%d%d", &r->w, &r->h, &r->x, &r->y) == 4) r->has_pos = 1;
+        } else if (strcmp(opt, "fullscreen") == 0) {
+            r->fullscreen = 1;
+        } else if (strcmp(opt, "hidden") == 0) {
+            r->hidden = 1;
+        }
+    }
+    return 1;
+}
+
+int parse_status(const char *line, StatusSpec *st) {
+    char name[32];
+    int n = 0;
+
+    memset(st, 0, sizeof(*st));
+    if (sscanf(line, "STATUS %31s %n%d %n", name, &n, &st->interval, &n) < 1) return 0;
+    if (line[n]) strncpy(st->arg, line + n, sizeof(st->arg) - 1);
+    if (st->interval < STATUS_MIN_MS) st->interval = STATUS_MIN_MS;
+    for (int i = 0; i < STATUS_LAST; i++) {
+        if (strcasecmp(name, status_names[i]) == 0) {
+            st->type = i;
+            return 1;
+        }
     }
+    return 0;
+}
 
+int parse_config(const char *path, struct Config *c, KeyBind *b, int *count, RuleSet *rs) {
     FILE *f = fopen(path, "r");
-    if (!f) return;
+    if (!f) return 0;
 
     char line[256];
+    int status_seen = 0;
+    *count = 0;
+    rs->count = 0;
 
     while (fgets(line, sizeof(line), f)) {
         line[strcspn(line, "\r\n")] = 0;
@@ -297,61 +1241,716 @@ void load_config(void) {
         char key[64], val[64];
         if (sscanf(line, "%63s %63s", key, val) == 2) {
             if (strcmp(key, "BAR_COLOR") == 0)
-                strncpy(conf.bar_color, val, sizeof(conf.bar_color) - 1);
+                strncpy(c->bar_color, val, sizeof(c->bar_color) - 1);
             else if (strcmp(key, "BG_COLOR") == 0)
-                strncpy(conf.bg_color, val, sizeof(conf.bg_color) - 1);
+                strncpy(c->bg_color, val, sizeof(c->bg_color) - 1);
             else if (strcmp(key, "BORDER_COLOR") == 0)
-                strncpy(conf.border_color, val, sizeof(conf.border_color) - 1);
+                strncpy(c->border_color, val, sizeof(c->border_color) - 1);
             else if (strcmp(key, "ACTIVE_BORDER_COLOR") == 0)
-                strncpy(conf.active_border_color, val, sizeof(conf.active_border_color) - 1);
+                strncpy(c->active_border_color, val, sizeof(c->active_border_color) - 1);
             else if (strcmp(key, "BUTTON_COLOR") == 0)
-                strncpy(conf.button_color, val, sizeof(conf.button_color) - 1);
+                strncpy(c->button_color, val, sizeof(c->button_color) - 1);
             else if (strcmp(key, "TEXT_COLOR") == 0)
-                strncpy(conf.text_color, val, sizeof(conf.text_color) - 1);
+                strncpy(c->text_color, val, sizeof(c->text_color) - 1);
             else if (strcmp(key, "LINE_COLOR") == 0)
-                strncpy(conf.line_color, val, sizeof(conf.line_color) - 1);
+                strncpy(c->line_color, val, sizeof(c->line_color) - 1);
             else if (strcmp(key, "HIGHLIGHT_COLOR") == 0)
-                strncpy(conf.highlight_color, val, sizeof(conf.highlight_color) - 1);
+                strncpy(c->highlight_color, val, sizeof(c->highlight_color) - 1);
             else if (strcmp(key, "FONT") == 0)
-                strncpy(conf.font_name, val, sizeof(conf.font_name) - 1);
+                sscanf(line, "%*s %63[^\t\n]", c->font_name);
             else if (strcmp(key, "MOUSE_MOD") == 0)
-                strncpy(conf.mouse_mod, val, sizeof(conf.mouse_mod) - 1);
+                strncpy(c->mouse_mod, val, sizeof(c->mouse_mod) - 1);
             else if (strcmp(key, "BORDER_WIDTH") == 0)
-                conf.border_width = atoi(val);
+                c->border_width = atoi(val);
+            else if (strcmp(key, "WORKSPACES") == 0)
+                c->workspaces = atoi(val);
+            else if (strcmp(key, "BAR_RATE") == 0)
+                c->bar_rate = atoi(val);
+            else if (strcmp(key, "ALTTAB_PREVIEW") == 0)
+                c->preview = atoi(val);
+            else if (strcmp(key, "PREVIEW_INTERVAL") == 0)
+                c->preview_interval = atoi(val);
+            else if (strcmp(key, "PREVIEW_MEMORY") == 0)
+                c->preview_memory = atoi(val);
         }
 
         char mod_str[32], key_str[32], cmd[128];
         if (sscanf(line, "BIND %31s %31s %127[^\t\n]", mod_str, key_str, cmd) == 3) {
-            if (bind_count < 128) {
-                binds[bind_count].mod = str_to_mod(mod_str);
-                binds[bind_count].key = XStringToKeysym(key_str);
-                if (binds[bind_count].key != NoSymbol) {
-                    strncpy(binds[bind_count].command, cmd, sizeof(binds[bind_count].command) - 1);
-                    bind_count++;
+            if (*count < MAX_BINDS) {
+                KeyBind *kb = &b[*count];
+                memset(kb, 0, sizeof(*kb));
+                kb->mod = str_to_mod(mod_str);
+                kb->key = XStringToKeysym(key_str);
+                if (kb->key != NoSymbol) {
+                    strncpy(kb->command, cmd, sizeof(kb->command) - 1);
+                    kb->action = parse_action(kb->command, &kb->arg);
+                    (*count)++;
                 }
             }
         }
+
+        if (strncmp(line, "RULE", 4) == 0 && rs->count < MAX_RULES &&
+            parse_rule(line, &rs->rules[rs->count])) {
+            rs->count++;
+        }
+
+        if (strncmp(line, "STATUS", 6) == 0) {
+            if (!status_seen) c->status_count = 0;
+            status_seen = 1;
+            if (c->status_count < MAX_STATUS && parse_status(line, &c->status[c->status_count])) {
+                c->status_count++;
+            }
+        }
     }
 
     fclose(f);
+    rules_build_index(rs);
+    return 1;
+}
+
+void load_config(void) {
+#ifdef STATIC_CONFIG
+    conf = static_conf;
+    bind_count = sizeof(static_binds) / sizeof(static_binds[0]);
+    if (bind_count > MAX_BINDS) bind_count = MAX_BINDS;
+    memcpy(binds, static_binds, sizeof(KeyBind) * bind_count);
+    mouse_mod_mask = static_mouse_mod;
+    ruleset.count = static_rule_count;
+    if (ruleset.count > MAX_RULES) ruleset.count = MAX_RULES;
+    memcpy(ruleset.rules, static_rules, sizeof(Rule) * ruleset.count);
+    rules_build_index(&ruleset);
+#else
+    config_defaults(&conf);
+    bind_count = 0;
+    ruleset.count = 0;
+    rules_build_index(&ruleset);
+
+    char path[256];
+    config_path(path, sizeof(path));
+    if (!path[0]) return;
+
+    if (access(path, F_OK) != 0) {
+        create_default_config(path);
+    }
+
+    parse_config(path, &conf, binds, &bind_count, &ruleset);
 
     mouse_mod_mask = str_to_mod(conf.mouse_mod);
     if (mouse_mod_mask == 0) mouse_mod_mask = Mod1Mask;
+#endif
+    conf.workspaces = clamp_workspaces(conf.workspaces);
 }
 
-void add_client(Window client, Window frame, int monitor) {
-    if (client_count >= MAX_CLIENTS) return;
-    
-    clients[client_count].client = client;
-    clients[client_count].frame = frame;
-    clients[client_count].is_fullscreen = 0;
-    clients[client_count].monitor = monitor;
-    memset(&clients[client_count].old_attr, 0, sizeof(XWindowAttributes));
-    client_count++;
+void alloc_pixels(void) {
+    px.bar = get_pixel(conf.bar_color);
+    px.bg = get_pixel(conf.bg_color);
+    px.border = get_pixel(conf.border_color);
+    px.active_border = get_pixel(conf.active_border_color);
+    px.button = get_pixel(conf.button_color);
+    px.text = get_pixel(conf.text_color);
+    px.line = get_pixel(conf.line_color);
+    px.highlight = get_pixel(conf.highlight_color);
+    px.dim = get_pixel("#888888");
 }
 
-void remove_client(Window client) {
-    int idx = -1;
+#define IPC_MAX_CONNS 16
+#define IPC_IN_SIZE   512
+#define IPC_OUT_SIZE  8192
+
+typedef struct {
+    int fd;
+    int subscribed;
+    int dead;
+    char in[IPC_IN_SIZE];
+    int in_len;
+    char out[IPC_OUT_SIZE];
+    int out_len;
+} IpcConn;
+
+int ipc_fd = -1;
+char ipc_path[108];
+IpcConn ipc_conns[IPC_MAX_CONNS];
+int ipc_count = 0;
+
+void ipc_drop(int i) {
+    close(ipc_conns[i].fd);
+    ipc_conns[i] = ipc_conns[--ipc_count];
+}
+
+int ipc_send(IpcConn *c, const char *msg, int len) {
+    if (c->out_len + len > IPC_OUT_SIZE) return 0;
+    memcpy(c->out + c->out_len, msg, len);
+    c->out_len += len;
+    return 1;
+}
+
+void ipc_event(const char *fmt, ...) {
+    char msg[512];
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(msg, sizeof(msg), fmt, ap);
+    va_end(ap);
+    if (len < 0) return;
+    if (len >= (int)sizeof(msg)) {
+        len = sizeof(msg) - 1;
+        msg[len - 1] = '\n';
+    }
+
+    for (int i = 0; i < ipc_count; i++) {
+        IpcConn *c = &ipc_conns[i];
+        if (c->subscribed && !c->dead && !ipc_send(c, msg, len)) c->dead = 1;
+    }
+}
+
+long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+const int icon_px[ICON_SIZES] = { 16, 32 };
+
+enum { JOB_ICON, JOB_THUMB };
+
+typedef struct {
+    Window win;
+    int kind;
+    int w, h;
+    unsigned int *pixels[ICON_SIZES];
+} IconJob;
+
+typedef struct {
+    unsigned int head;
+    unsigned int tail;
+    IconJob *slot[ICON_QUEUE];
+} IconQueue;
+
+IconQueue icon_requests, icon_results;
+IconJob icon_jobs[ICON_QUEUE];
+IconJob *icon_spare[ICON_QUEUE];
+int icon_spare_count = 0;
+int icon_wake_fd = -1;
+int icon_done_fd = -1;
+int icon_quit = 0;
+int icon_running = 0;
+pthread_t icon_thread;
+
+int icon_push(IconQueue *q, IconJob *job) {
+    unsigned int tail = q->tail;
+    if (tail - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) == ICON_QUEUE) return 0;
+    q->slot[tail % ICON_QUEUE] = job;
+    __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+IconJob *icon_pop(IconQueue *q) {
+    unsigned int head = q->head;
+    if (head == __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE)) return NULL;
+    IconJob *job = q->slot[head % ICON_QUEUE];
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+    return job;
+}
+
+void icon_signal(int fd) {
+    uint64_t one = 1;
+    ssize_t r = write(fd, &one, sizeof(one));
+    (void)r;
+}
+
+IconJob *icon_job_new(void) {
+    if (!icon_spare_count) return NULL;
+    IconJob *job = icon_spare[--icon_spare_count];
+    memset(job, 0, sizeof(*job));
+    return job;
+}
+
+void icon_job_free(IconJob *job) {
+    for (int i = 0; i < ICON_SIZES; i++) free(job->pixels[i]);
+    icon_spare[icon_spare_count++] = job;
+}
+
+unsigned long pack_channel(unsigned long mask, unsigned int v) {
+    int shift = 0;
+    while (mask && !((mask >> shift) & 1)) shift++;
+    return ((v * (mask >> shift) + 127) / 255) << shift;
+}
+
+unsigned int unpack_channel(unsigned long pixel, unsigned long mask) {
+    int shift = 0;
+    while (mask && !((mask >> shift) & 1)) shift++;
+    unsigned long max = mask >> shift;
+    return max ? ((pixel & mask) >> shift) * 255 / max : 0;
+}
+
+void box_filter(const unsigned int *src, int sw, int sh, int sstride,
+                unsigned int *dst, int dw, int dh, int dstride) {
+    for (int dy = 0; dy < dh; dy++) {
+        int y0 = dy * sh / dh, y1 = (dy + 1) * sh / dh;
+        if (y1 <= y0) y1 = y0 + 1;
+        for (int dx = 0; dx < dw; dx++) {
+            int x0 = dx * sw / dw, x1 = (dx + 1) * sw / dw;
+            if (x1 <= x0) x1 = x0 + 1;
+            int n = (x1 - x0) * (y1 - y0);
+#ifdef __SSE2__
+            __m128i zero = _mm_setzero_si128(), acc = zero;
+            for (int y = y0; y < y1; y++) {
+                const unsigned int *row = src + y * sstride;
+                int x = x0;
+                for (; x + 4 <= x1; x += 4) {
+                    __m128i p = _mm_loadu_si128((const __m128i *)(row + x));
+                    __m128i s = _mm_add_epi16(_mm_unpacklo_epi8(p, zero), _mm_unpackhi_epi8(p, zero));
+                    acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(s, zero));
+                    acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(s, zero));
+                }
+                for (; x + 2 <= x1; x += 2) {
+                    __m128i p = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(row + x)), zero);
+                    acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(p, zero));
+                    acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(p, zero));
+                }
+                if (x < x1) {
+                    __m128i p = _mm_unpacklo_epi8(_mm_cvtsi32_si128(row[x]), zero);
+                    acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(p, zero));
+                }
+            }
+            __m128i v = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(acc), _mm_set1_ps(1.0f / n)));
+            v = _mm_packs_epi32(v, v);
+            v = _mm_packus_epi16(v, v);
+            dst[dy * dstride + dx] = _mm_cvtsi128_si32(v);
+#else
+            unsigned int sum[4] = { 0, 0, 0, 0 };
+            for (int y = y0; y < y1; y++) {
+                for (int x = x0; x < x1; x++) {
+                    unsigned int p = src[y * sstride + x];
+                    for (int c = 0; c < 4; c++) sum[c] += (p >> (c * 8)) & 0xff;
+                }
+            }
+            unsigned int out = 0;
+            for (int c = 0; c < 4; c++) out |= ((sum[c] + n / 2) / n) << (c * 8);
+            dst[dy * dstride + dx] = out;
+#endif
+        }
+    }
+}
+
+void icon_box_filter(const unsigned int *src, int sw, int sh, unsigned int *dst, int size) {
+    int m = sw > sh ? sw : sh;
+    int dw = sw * size / m, dh = sh * size / m;
+    if (dw < 1) dw = 1;
+    if (dh < 1) dh = 1;
+    int ox = (size - dw) / 2, oy = (size - dh) / 2;
+
+    memset(dst, 0, sizeof(*dst) * size * size);
+    box_filter(src, sw, sh, sw, dst + oy * size + ox, dw, dh, size);
+}
+
+unsigned int *icon_decode(const unsigned long *data, unsigned long n, int size) {
+    const unsigned long *best = NULL;
+    int bw = 0, bh = 0;
+
+    for (unsigned long i = 0; i + 2 <= n;) {
+        unsigned long w = data[i], h = data[i + 1];
+        if (!w || !h || w > 1024 || h > 1024 || w * h > n - i - 2) break;
+        int m = w > h ? w : h, bm = bw > bh ? bw : bh;
+        if (!best || (bm < size ? m > bm : (m >= size && m < bm))) {
+            best = data + i + 2;
+            bw = w;
+            bh = h;
+        }
+        i += 2 + w * h;
+    }
+    if (!best) return NULL;
+
+    unsigned int *pre = malloc(sizeof(*pre) * bw * bh);
+    unsigned int *out = malloc(sizeof(*out) * size * size);
+    if (!pre || !out) {
+        free(pre);
+        free(out);
+        return NULL;
+    }
+    for (int i = 0; i < bw * bh; i++) {
+        unsigned int p = best[i], a = p >> 24;
+        unsigned int r = (((p >> 16) & 0xff) * a + 127) / 255;
+        unsigned int g = (((p >> 8) & 0xff) * a + 127) / 255;
+        unsigned int b = ((p & 0xff) * a + 127) / 255;
+        pre[i] = (a << 24) | (r << 16) | (g << 8) | b;
+    }
+    icon_box_filter(pre, bw, bh, out, size);
+    free(pre);
+    return out;
+}
+
+void thumb_shm_release(Display *d, XShmSegmentInfo *shm) {
+    if (!shm->shmaddr) return;
+    XShmDetach(d, shm);
+    XSync(d, False);
+    shmdt(shm->shmaddr);
+    shm->shmaddr = NULL;
+    __atomic_store_n(&thumb_shm_bytes, 0, __ATOMIC_RELAXED);
+}
+
+int thumb_shm_reserve(Display *d, XShmSegmentInfo *shm, long size) {
+    if (shm->shmaddr && __atomic_load_n(&thumb_shm_bytes, __ATOMIC_RELAXED) >= size) return 1;
+    thumb_shm_release(d, shm);
+
+    shm->shmid = shmget(IPC_PRIVATE, size, IPC_CREAT | 0600);
+    if (shm->shmid < 0) return 0;
+    shm->shmaddr = shmat(shm->shmid, NULL, 0);
+    if (shm->shmaddr == (char *)-1) {
+        shm->shmaddr = NULL;
+        shmctl(shm->shmid, IPC_RMID, NULL);
+        return 0;
+    }
+    shm->readOnly = False;
+    int ok = XShmAttach(d, shm);
+    XSync(d, False);
+    shmctl(shm->shmid, IPC_RMID, NULL);
+    if (!ok) {
+        shmdt(shm->shmaddr);
+        shm->shmaddr = NULL;
+        return 0;
+    }
+    __atomic_store_n(&thumb_shm_bytes, size, __ATOMIC_RELAXED);
+    return 1;
+}
+
+unsigned int *thumb_capture(Display *d, Window win, XShmSegmentInfo *shm, int *tw, int *th) {
+    XWindowAttributes wa;
+    if (!XGetWindowAttributes(d, win, &wa) || wa.map_state != IsViewable) return NULL;
+    if (wa.depth < 24 || wa.visual->class != TrueColor) return NULL;
+
+    int rx, ry;
+    Window child;
+    if (!XTranslateCoordinates(d, win, wa.root, 0, 0, &rx, &ry, &child)) return NULL;
+    int scr = XScreenNumberOfScreen(wa.screen);
+    int ox = rx < 0 ? -rx : 0, oy = ry < 0 ? -ry : 0;
+    int sw = (rx + wa.width < DisplayWidth(d, scr) ? wa.width : DisplayWidth(d, scr) - rx) - ox;
+    int sh = (ry + wa.height < DisplayHeight(d, scr) ? wa.height : DisplayHeight(d, scr) - ry) - oy;
+    if (sw < 1 || sh < 1) return NULL;
+    if (sw > THUMB_MAX_SRC) sw = THUMB_MAX_SRC;
+    if (sh > THUMB_MAX_SRC) sh = THUMB_MAX_SRC;
+    int dw = sw, dh = sh;
+    if (dw > THUMB_W || dh > THUMB_H) {
+        if (sw * THUMB_H > sh * THUMB_W) {
+            dw = THUMB_W;
+            dh = sh * THUMB_W / sw;
+        } else {
+            dh = THUMB_H;
+            dw = sw * THUMB_H / sh;
+        }
+        if (dw < 1) dw = 1;
+        if (dh < 1) dh = 1;
+    }
+
+    unsigned int *out = malloc(sizeof(*out) * dw * dh);
+    if (!out) return NULL;
+
+    int step = THUMB_STRIP_BYTES / (sw * 4) * dh / sh;
+    if (step < 1) step = 1;
+    for (int dy = 0; dy < dh; dy += step) {
+        int dy1 = dy + step < dh ? dy + step : dh;
+        int y0 = dy * sh / dh, n = dy1 * sh / dh - y0;
+        XImage *img;
+        if (shm) {
+            img = XShmCreateImage(d, wa.visual, wa.depth, ZPixmap, NULL, shm, sw, n);
+            if (img && thumb_shm_reserve(d, shm, (long)img->bytes_per_line * n)) {
+                img->data = shm->shmaddr;
+                if (!XShmGetImage(d, win, img, ox, oy + y0, AllPlanes)) {
+                    XDestroyImage(img);
+                    img = NULL;
+                }
+            } else if (img) {
+                XDestroyImage(img);
+                img = NULL;
+            }
+        } else {
+            img = XGetImage(d, win, ox, oy + y0, sw, n, AllPlanes, ZPixmap);
+        }
+        if (!img || img->bits_per_pixel != 32) {
+            if (img) XDestroyImage(img);
+            free(out);
+            return NULL;
+        }
+        box_filter((unsigned int *)img->data, sw, n, img->bytes_per_line / 4,
+                   out + dy * dw, dw, dy1 - dy, dw);
+        XDestroyImage(img);
+    }
+
+    for (int i = 0; i < dw * dh; i++) {
+        unsigned int p = out[i];
+        out[i] = (unpack_channel(p, wa.visual->red_mask) << 16) |
+                 (unpack_channel(p, wa.visual->green_mask) << 8) |
+                 unpack_channel(p, wa.visual->blue_mask);
+    }
+    *tw = dw;
+    *th = dh;
+    return out;
+}
+
+void icon_fetch(Display *d, Atom net_wm_icon, IconJob *job) {
+    Atom type;
+    int format;
+    unsigned long n, after;
+    unsigned char *prop = NULL;
+    if (XGetWindowProperty(d, job->win, net_wm_icon, 0, ICON_MAX_DATA, False, XA_CARDINAL,
+                           &type, &format, &n, &after, &prop) != Success || !prop) return;
+    if (format == 32) {
+        for (int i = 0; i < ICON_SIZES; i++) {
+            job->pixels[i] = icon_decode((unsigned long *)prop, n, icon_px[i]);
+        }
+    }
+    XFree(prop);
+}
+
+void *icon_worker(void *arg) {
+    Display *d = arg;
+    Atom net_wm_icon = XInternAtom(d, "_NET_WM_ICON", False);
+    XShmSegmentInfo shm_info = { 0 };
+    XShmSegmentInfo *shm = XShmQueryExtension(d) ? &shm_info : NULL;
+
+    while (!__atomic_load_n(&icon_quit, __ATOMIC_ACQUIRE)) {
+        uint64_t v;
+        if (read(icon_wake_fd, &v, sizeof(v)) < 0 && errno != EINTR) break;
+
+        IconJob *job;
+        int done = 0;
+        while (!__atomic_load_n(&icon_quit, __ATOMIC_ACQUIRE) && (job = icon_pop(&icon_requests))) {
+            if (job->kind == JOB_THUMB) {
+                job->pixels[0] = thumb_capture(d, job->win, shm, &job->w, &job->h);
+            } else {
+                icon_fetch(d, net_wm_icon, job);
+            }
+            while (!icon_push(&icon_results, job)) {
+                icon_signal(icon_done_fd);
+                usleep(1000);
+            }
+            done = 1;
+        }
+        if (done) icon_signal(icon_done_fd);
+    }
+    thumb_shm_release(d, &shm_info);
+    XCloseDisplay(d);
+    return NULL;
+}
+
+void icon_open(void) {
+    Display *d = XOpenDisplay(DisplayString(dpy));
+    if (!d) return;
+
+    for (icon_spare_count = 0; icon_spare_count < ICON_QUEUE; icon_spare_count++) {
+        icon_spare[icon_spare_count] = &icon_jobs[icon_spare_count];
+    }
+
+    icon_wake_fd = eventfd(0, EFD_CLOEXEC);
+    icon_done_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (icon_wake_fd < 0 || icon_done_fd < 0 ||
+        pthread_create(&icon_thread, NULL, icon_worker, d) != 0) {
+        if (icon_wake_fd >= 0) close(icon_wake_fd);
+        if (icon_done_fd >= 0) close(icon_done_fd);
+        icon_wake_fd = icon_done_fd = -1;
+        XCloseDisplay(d);
+        return;
+    }
+    icon_running = 1;
+}
+
+void icon_close(void) {
+    if (!icon_running) return;
+    __atomic_store_n(&icon_quit, 1, __ATOMIC_RELEASE);
+    icon_signal(icon_wake_fd);
+    pthread_join(icon_thread, NULL);
+    icon_running = 0;
+
+    IconJob *job;
+    while ((job = icon_pop(&icon_requests))) icon_job_free(job);
+    while ((job = icon_pop(&icon_results))) icon_job_free(job);
+    close(icon_wake_fd);
+    close(icon_done_fd);
+    icon_wake_fd = icon_done_fd = -1;
+}
+
+void icon_request(ClientState *cs) {
+    ClientCold *cc = cold(cs);
+    if (!icon_running) return;
+    if (cc->icon_busy) {
+        cc->icon_stale = 1;
+        return;
+    }
+    IconJob *job = icon_job_new();
+    if (!job) return;
+    job->win = cs->client;
+    if (!icon_push(&icon_requests, job)) {
+        icon_job_free(job);
+        return;
+    }
+    cc->icon_busy = 1;
+    cc->icon_stale = 0;
+    icon_signal(icon_wake_fd);
+}
+
+void icon_free(ClientState *cs) {
+    ClientCold *cc = cold(cs);
+    for (int i = 0; i < ICON_SIZES; i++) {
+        free(cc->icon[i]);
+        cc->icon[i] = NULL;
+        if (cc->icon_pix[i]) XFreePixmap(dpy, cc->icon_pix[i]);
+        cc->icon_pix[i] = None;
+        cc->icon_valid[i] = 0;
+    }
+}
+
+Pixmap icon_pixmap(ClientState *cs, int s, unsigned long bg) {
+    ClientCold *cc = cold(cs);
+    if (!cc->icon[s]) return None;
+    if (cc->icon_pix[s] && cc->icon_valid[s] && cc->icon_bg[s] == bg) return cc->icon_pix[s];
+
+    int scr = DefaultScreen(dpy);
+    Visual *vis = DefaultVisual(dpy, scr);
+    if (vis->class != TrueColor) return None;
+
+    int size = icon_px[s], depth = DefaultDepth(dpy, scr);
+    XImage *img = XCreateImage(dpy, vis, depth, ZPixmap, 0, NULL, size, size, 32, 0);
+    if (!img) return None;
+    size_t mark = batch_arena.used;
+    img->data = arena_alloc(&batch_arena, img->bytes_per_line * size);
+    if (!img->data) {
+        XDestroyImage(img);
+        return None;
+    }
+
+    unsigned int br = unpack_channel(bg, vis->red_mask);
+    unsigned int bgg = unpack_channel(bg, vis->green_mask);
+    unsigned int bb = unpack_channel(bg, vis->blue_mask);
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            unsigned int p = cc->icon[s][y * size + x], k = 255 - (p >> 24);
+            unsigned int r = ((p >> 16) & 0xff) + (br * k + 127) / 255;
+            unsigned int g = ((p >> 8) & 0xff) + (bgg * k + 127) / 255;
+            unsigned int b = (p & 0xff) + (bb * k + 127) / 255;
+            XPutPixel(img, x, y, pack_channel(vis->red_mask, r) | pack_channel(vis->green_mask, g) |
+                                 pack_channel(vis->blue_mask, b));
+        }
+    }
+
+    if (!cc->icon_pix[s]) cc->icon_pix[s] = XCreatePixmap(dpy, root, size, size, depth);
+    XPutImage(dpy, cc->icon_pix[s], DefaultGC(dpy, scr), img, 0, 0, 0, 0, size, size);
+    img->data = NULL;
+    XDestroyImage(img);
+    batch_arena.used = mark;
+    cc->icon_bg[s] = bg;
+    cc->icon_valid[s] = 1;
+    return cc->icon_pix[s];
+}
+
+void thumb_free(ClientState *cs) {
+    ClientCold *cc = cold(cs);
+    if (!cc->thumb_pix) return;
+    XFreePixmap(dpy, cc->thumb_pix);
+    cc->thumb_pix = None;
+    thumb_count--;
+    thumb_bytes -= (long)cc->thumb_w * cc->thumb_h * 4;
+    snapshot_dirty = 1;
+}
+
+void thumb_evict(ClientState *keep) {
+    while (thumb_bytes > (long)conf.preview_memory * 1024) {
+        ClientState *old = NULL;
+        for (int i = 0; i < client_count; i++) {
+            ClientState *cs = &clients[i];
+            if (cold(cs)->thumb_pix && cs != keep && (!old || cs->last_focus < old->last_focus)) old = cs;
+        }
+        if (!old) break;
+        thumb_free(old);
+    }
+}
+
+void thumb_request(ClientState *cs) {
+    if (!cs || !conf.preview || !icon_running || !cs->frame || cold(cs)->thumb_busy) return;
+    if (cs->is_hidden || cs->ws_hidden) return;
+    long long now = now_ms();
+    if (now - cold(cs)->thumb_time < conf.preview_interval * 1000LL) return;
+
+    IconJob *job = icon_job_new();
+    if (!job) return;
+    job->win = cs->client;
+    job->kind = JOB_THUMB;
+    if (!icon_push(&icon_requests, job)) {
+        icon_job_free(job);
+        return;
+    }
+    cold(cs)->thumb_busy = 1;
+    cold(cs)->thumb_time = now;
+    icon_signal(icon_wake_fd);
+}
+
+void thumb_store(ClientState *cs, const unsigned int *pixels, int w, int h) {
+    ClientCold *cc = cold(cs);
+    long bytes = (long)w * h * 4;
+    int scr = DefaultScreen(dpy);
+    Visual *vis = DefaultVisual(dpy, scr);
+    if (bytes > (long)conf.preview_memory * 1024 || vis->class != TrueColor) return;
+
+    int depth = DefaultDepth(dpy, scr);
+    XImage *img = XCreateImage(dpy, vis, depth, ZPixmap, 0, NULL, w, h, 32, 0);
+    if (!img) return;
+    size_t mark = batch_arena.used;
+    img->data = arena_alloc(&batch_arena, img->bytes_per_line * h);
+    if (!img->data) {
+        XDestroyImage(img);
+        return;
+    }
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            unsigned int p = pixels[y * w + x];
+            XPutPixel(img, x, y, pack_channel(vis->red_mask, (p >> 16) & 0xff) |
+                                 pack_channel(vis->green_mask, (p >> 8) & 0xff) |
+                                 pack_channel(vis->blue_mask, p & 0xff));
+        }
+    }
+
+    if (cc->thumb_pix && (cc->thumb_w != w || cc->thumb_h != h)) thumb_free(cs);
+    if (!cc->thumb_pix) {
+        cc->thumb_pix = XCreatePixmap(dpy, root, w, h, depth);
+        cc->thumb_w = w;
+        cc->thumb_h = h;
+        thumb_count++;
+        thumb_bytes += bytes;
+        snapshot_dirty = 1;
+    }
+    XPutImage(dpy, cc->thumb_pix, DefaultGC(dpy, scr), img, 0, 0, 0, 0, w, h);
+    img->data = NULL;
+    XDestroyImage(img);
+    batch_arena.used = mark;
+    thumb_evict(cs);
+}
+
+void add_client(Window client, Window frame, int monitor) {
+    if (client_count >= MAX_CLIENTS) return;
+    
+    int slot = 0;
+    while (client_cold[slot].used) slot++;
+    ClientCold *cc = &client_cold[slot];
+    memset(cc, 0, sizeof(*cc));
+    cc->used = 1;
+    cc->session_slot = -1;
+    cc->title_fit_w = -1;
+
+    ClientState *cs = &clients[client_count++];
+    memset(cs, 0, sizeof(*cs));
+    grid_reserve(client_count);
+    cs->client = client;
+    cs->frame = frame;
+    cs->monitor = monitor;
+    cs->cold = slot;
+    snapshot_dirty = 1;
+}
+
+void mark_monitor_dirty(int mon) {
+    if (mon >= 0 && mon < monitor_count) monitors[mon].dirty = 1;
+    snapshot_dirty = 1;
+}
+
+void remove_client(Window client) {
+    int idx = -1;
     for (int i = 0; i < client_count; i++) {
         if (clients[i].client == client) {
             idx = i;
@@ -359,6 +1958,19 @@ void remove_client(Window client) {
         }
     }
     if (idx >= 0) {
+        ClientState *cs = &clients[idx];
+        ClientCold *cc = cold(cs);
+        if (cs->frame) {
+            mark_monitor_dirty(cs->monitor);
+            ipc_event("unmap 0x%lx\n", client);
+        }
+#ifdef HAVE_XFT
+        if (cc->title_pix) XFreePixmap(dpy, cc->title_pix);
+#endif
+        icon_free(cs);
+        thumb_free(cs);
+        if (cc->indexed) grid_remove(cs->frame, cc->ix, cc->iy, cc->iw, cc->ih);
+        cc->used = 0;
         for (int i = idx; i < client_count - 1; i++) {
             clients[i] = clients[i + 1];
         }
@@ -411,8 +2023,17 @@ void init_hints(void) {
     wmatoms[NET_WM_WINDOW_TYPE_SPLASH] = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_SPLASH", False);
     wmatoms[NET_WM_WINDOW_TYPE_UTILITY] = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_UTILITY", False);
     wmatoms[NET_WM_WINDOW_TYPE_NOTIFICATION] = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_NOTIFICATION", False);
+    wmatoms[NET_WM_PING] = XInternAtom(dpy, "_NET_WM_PING", False);
+    wmatoms[NET_WM_PID] = XInternAtom(dpy, "_NET_WM_PID", False);
+    wmatoms[NET_NUMBER_OF_DESKTOPS] = XInternAtom(dpy, "_NET_NUMBER_OF_DESKTOPS", False);
+    wmatoms[NET_CURRENT_DESKTOP] = XInternAtom(dpy, "_NET_CURRENT_DESKTOP", False);
+    wmatoms[NET_WM_DESKTOP] = XInternAtom(dpy, "_NET_WM_DESKTOP", False);
+    wmatoms[NET_WM_ICON] = XInternAtom(dpy, "_NET_WM_ICON", False);
     wmatoms[WM_PROTOCOLS] = XInternAtom(dpy, "WM_PROTOCOLS", False);
     wmatoms[WM_DELETE_WINDOW] = XInternAtom(dpy, "WM_DELETE_WINDOW", False);
+    wmatoms[WM_STATE] = XInternAtom(dpy, "WM_STATE", False);
+    wmatoms[WM_CHANGE_STATE] = XInternAtom(dpy, "WM_CHANGE_STATE", False);
+    wmatoms[WM_WINDOW_ROLE] = XInternAtom(dpy, "WM_WINDOW_ROLE", False);
 
     XChangeProperty(dpy, root, wmatoms[NET_SUPPORTED], XA_ATOM, 32, PropModeReplace,
                     (unsigned char *)wmatoms, ATOM_LAST);
@@ -433,7 +2054,8 @@ void update_client_list(void) {
         return;
     }
     
-    Window *list = malloc(sizeof(Window) * client_count);
+    size_t mark = batch_arena.used;
+    Window *list = arena_alloc(&batch_arena, sizeof(Window) * client_count);
     if (!list) return;
     
     for (int i = 0; i < client_count; i++) {
@@ -442,14 +2064,106 @@ void update_client_list(void) {
     
     XChangeProperty(dpy, root, wmatoms[NET_CLIENT_LIST], XA_WINDOW, 32, PropModeReplace,
                     (unsigned char *)list, client_count);
-    free(list);
+    batch_arena.used = mark;
 }
 
 void set_active_window(Window w) {
+    static Window last = None;
+    ClientState *cs = get_client_state(w);
+    if (cs) cs->last_focus = ++focus_serial;
+    if (w != last) {
+        ipc_event("focus 0x%lx\n", w);
+        thumb_request(get_client_state(last));
+    }
+    last = w;
+    snapshot_dirty = 1;
     XChangeProperty(dpy, root, wmatoms[NET_ACTIVE_WINDOW], XA_WINDOW, 32, PropModeReplace,
                     (unsigned char *)&w, 1);
 }
 
+void set_wm_state(Window client, long state) {
+    long data[2] = { state, None };
+    XChangeProperty(dpy, client, wmatoms[WM_STATE], wmatoms[WM_STATE], 32,
+                    PropModeReplace, (unsigned char *)data, 2);
+}
+
+long get_wm_state(Window client) {
+    Atom actual_type;
+    int actual_format;
+    unsigned long nitems, bytes_after;
+    unsigned char *prop = NULL;
+    long state = WithdrawnState;
+    if (XGetWindowProperty(dpy, client, wmatoms[WM_STATE], 0, 2, False, wmatoms[WM_STATE],
+                           &actual_type, &actual_format, &nitems, &bytes_after,
+                           &prop) == Success && prop) {
+        if (nitems && actual_format == 32) state = *(long *)prop;
+        XFree(prop);
+    }
+    return state;
+}
+
+int fetch_title(ClientState *cs) {
+    ClientCold *cc = cold(cs);
+    char old[sizeof(cc->title)];
+    char *name = NULL;
+
+    memcpy(old, cc->title, sizeof(old));
+    cc->title[0] = '\0';
+#ifdef HAVE_XFT
+    XTextProperty tp;
+    if (xft_font && XGetTextProperty(dpy, cs->client, &tp, wmatoms[NET_WM_NAME]) && tp.value) {
+        snprintf(cc->title, sizeof(cc->title), "%s", (char *)tp.value);
+        XFree(tp.value);
+    } else
+#endif
+    if (XFetchName(dpy, cs->client, &name) && name) {
+        snprintf(cc->title, sizeof(cc->title), "%s", name);
+        XFree(name);
+    }
+    for (char *p = cc->title; *p; p++) {
+        if ((unsigned char)*p < 0x20) *p = ' ';
+    }
+    if (strcmp(old, cc->title) == 0) return 0;
+    cc->title_fit_w = -1;
+    snapshot_dirty = 1;
+    return 1;
+}
+
+void set_client_desktop(ClientState *cs) {
+    long desktop = cs->workspace;
+    XChangeProperty(dpy, cs->client, wmatoms[NET_WM_DESKTOP], XA_CARDINAL, 32,
+                    PropModeReplace, (unsigned char *)&desktop, 1);
+}
+
+void hide_client(ClientState *cs) {
+    if (!cs || !cs->frame || cs->is_hidden) return;
+    if (!cs->ws_hidden) {
+        XUnmapWindow(dpy, cs->frame);
+        XUnmapWindow(dpy, cs->client);
+        cold(cs)->ignore_unmap++;
+    }
+    cs->is_hidden = 1;
+    cs->ws_hidden = 0;
+    cs->due |= DUE_SESSION;
+    set_wm_state(cs->client, IconicState);
+    grid_update(cs);
+    mark_monitor_dirty(cs->monitor);
+}
+
+void show_client(ClientState *cs) {
+    if (!cs || !cs->frame || !cs->is_hidden) return;
+    cs->is_hidden = 0;
+    cs->due |= DUE_SESSION;
+    cs->ws_hidden = !on_current_workspace(cs);
+    if (!cs->ws_hidden) {
+        XMapWindow(dpy, cs->client);
+        XMapWindow(dpy, cs->frame);
+        set_wm_state(cs->client, NormalState);
+    }
+    grid_update(cs);
+    mark_monitor_dirty(cs->monitor);
+}
+
 void spawn(const char *command) {
     if (!command) return;
     
@@ -462,73 +2176,277 @@ void spawn(const char *command) {
     }
 }
 
-void close_client(Window client) {
-    if (!client) return;
-
+void fetch_protocols(ClientState *cs) {
+    ClientCold *cc = cold(cs);
     Atom *protocols = NULL;
     int n = 0;
-    int supports_delete = 0;
 
-    if (XGetWMProtocols(dpy, client, &protocols, &n)) {
+    cc->protocols = 0;
+    if (XGetWMProtocols(dpy, cs->client, &protocols, &n)) {
         for (int i = 0; i < n; i++) {
-            if (protocols[i] == wmatoms[WM_DELETE_WINDOW]) {
-                supports_delete = 1;
-                break;
-            }
+            if (protocols[i] == wmatoms[WM_DELETE_WINDOW]) cc->protocols |= PROTO_DELETE;
+            else if (protocols[i] == wmatoms[NET_WM_PING]) cc->protocols |= PROTO_PING;
         }
         if (protocols) XFree(protocols);
     }
 
-    if (supports_delete) {
-        XEvent ev;
-        memset(&ev, 0, sizeof(ev));
-        ev.type = ClientMessage;
-        ev.xclient.window = client;
-        ev.xclient.message_type = wmatoms[WM_PROTOCOLS];
-        ev.xclient.format = 32;
-        ev.xclient.data.l[0] = wmatoms[WM_DELETE_WINDOW];
-        ev.xclient.data.l[1] = CurrentTime;
-        XSendEvent(dpy, client, False, NoEventMask, &ev);
-    } else {
-        XKillClient(dpy, client);
+    cc->pid = 0;
+    Atom actual_type;
+    int actual_format;
+    unsigned long nitems, bytes_after;
+    unsigned char *prop = NULL;
+    if (XGetWindowProperty(dpy, cs->client, wmatoms[NET_WM_PID], 0, 1, False, XA_CARDINAL,
+                           &actual_type, &actual_format, &nitems, &bytes_after,
+                           &prop) == Success && prop) {
+        if (nitems == 1 && actual_format == 32) {
+            pid_t pid = (pid_t)*(unsigned long *)prop;
+            char host[256];
+            XTextProperty machine;
+            if (gethostname(host, sizeof(host)) == 0 &&
+                XGetWMClientMachine(dpy, cs->client, &machine)) {
+                if (machine.value && strncmp((char *)machine.value, host, sizeof(host)) == 0) {
+                    cc->pid = pid;
+                }
+                XFree(machine.value);
+            }
+        }
+        XFree(prop);
     }
+
+    cc->protocols_valid = 1;
 }
 
-void toggle_fullscreen(Window client) {
-    Window frame = get_frame(client);
-    if (!frame) return;
+void send_protocol(Window client, Atom proto) {
+    XEvent ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.type = ClientMessage;
+    ev.xclient.window = client;
+    ev.xclient.message_type = wmatoms[WM_PROTOCOLS];
+    ev.xclient.format = 32;
+    ev.xclient.data.l[0] = proto;
+    ev.xclient.data.l[1] = CurrentTime;
+    ev.xclient.data.l[2] = client;
+    XSendEvent(dpy, client, False, NoEventMask, &ev);
+}
+
+void kill_client(ClientState *cs) {
+    if (cold(cs)->pid > 0) kill(cold(cs)->pid, SIGKILL);
+    XKillClient(dpy, cs->client);
+}
+
+void close_client(Window client) {
+    if (!client) return;
+
+    ClientState *cs = get_client_state(client);
+    if (!cs) {
+        XKillClient(dpy, client);
+        return;
+    }
+    ClientCold *cc = cold(cs);
 
+    if (cc->unresponsive) {
+        kill_client(cs);
+        return;
+    }
+
+    if (!cc->protocols_valid) fetch_protocols(cs);
+
+    if (!(cc->protocols & PROTO_DELETE)) {
+        XKillClient(dpy, client);
+        return;
+    }
+
+    send_protocol(client, wmatoms[WM_DELETE_WINDOW]);
+    if ((cc->protocols & PROTO_PING) && !cc->ping_deadline) {
+        send_protocol(client, wmatoms[NET_WM_PING]);
+        cc->ping_deadline = now_ms() + PING_TIMEOUT_MS;
+        cs->due |= DUE_PING;
+    }
+}
+
+void ping_reply(Window client) {
     ClientState *cs = get_client_state(client);
     if (!cs) return;
+    ClientCold *cc = cold(cs);
+
+    cc->ping_deadline = 0;
+    cs->due &= ~DUE_PING;
+    if (cc->unresponsive) {
+        cc->unresponsive = 0;
+        if (cs->frame) XClearArea(dpy, cs->frame, 0, 0, 0, 0, True);
+    }
+}
+
+long long ping_tick(long long now) {
+    long long next = 0;
+    for (int i = 0; i < client_count; i++) {
+        ClientState *cs = &clients[i];
+        if (!(cs->due & DUE_PING)) continue;
+        ClientCold *cc = cold(cs);
+        if (now >= cc->ping_deadline) {
+            cc->ping_deadline = 0;
+            cs->due &= ~DUE_PING;
+            cc->unresponsive = 1;
+            if (cs->frame) XClearArea(dpy, cs->frame, 0, 0, 0, 0, True);
+        } else if (!next || cc->ping_deadline < next) {
+            next = cc->ping_deadline;
+        }
+    }
+    return next;
+}
+
+int is_tiled(ClientState *cs) {
+    return cs->frame && !cs->is_fullscreen && cs->monitor >= 0 && cs->monitor < monitor_count &&
+           monitors[cs->monitor].layout != LAYOUT_FLOAT;
+}
+
+int client_top(ClientState *cs) {
+    return cs->is_fullscreen ? 0 : TITLE_HEIGHT;
+}
+
+void send_configure_notify(ClientState *cs) {
+    XConfigureEvent ce;
+    memset(&ce, 0, sizeof(ce));
+    ce.type = ConfigureNotify;
+    ce.event = cs->client;
+    ce.window = cs->client;
+    ce.x = cs->x + conf.border_width;
+    ce.y = cs->y + conf.border_width + client_top(cs);
+    ce.width = cs->w;
+    ce.height = cs->h - client_top(cs);
+    ce.border_width = 0;
+    ce.above = None;
+    ce.override_redirect = False;
+    XSendEvent(dpy, cs->client, False, StructureNotifyMask, (XEvent *)&ce);
+}
+
+void configure_client(ClientState *cs, int x, int y, int w, int h) {
+    int resized = (w != cs->w || h != cs->h);
+    int top = client_top(cs);
+
+    cs->x = x;
+    cs->y = y;
+    cs->w = w;
+    cs->h = h;
+    cs->due |= DUE_SESSION;
+    snapshot_dirty = 1;
+    int mon = get_monitor_at(x + w / 2, y + h / 2);
+    if (mon != cs->monitor) {
+        mark_monitor_dirty(cs->monitor);
+        mark_monitor_dirty(mon);
+        cs->monitor = mon;
+        cs->workspace = monitors[mon].workspace;
+        set_client_desktop(cs);
+    }
+    grid_update(cs);
+
+    if (resized) {
+        XMoveResizeWindow(dpy, cs->frame, x, y, w, h);
+        XMoveResizeWindow(dpy, cs->client, 0, top, w, h - top);
+    } else {
+        XMoveWindow(dpy, cs->frame, x, y);
+        send_configure_notify(cs);
+    }
+}
+
+int get_geometry(Window win, XWindowAttributes *attr) {
+    ClientState *cs = get_client_state_by_frame(win);
+    if (!cs) return XGetWindowAttributes(dpy, win, attr);
+    attr->x = cs->x;
+    attr->y = cs->y;
+    attr->width = cs->w;
+    attr->height = cs->h;
+    return 1;
+}
+
+void save_restore_geometry(ClientState *cs) {
+    ClientCold *cc = cold(cs);
+    cc->old_x = cs->x;
+    cc->old_y = cs->y;
+    cc->old_w = cs->w;
+    cc->old_h = cs->h;
+}
+
+void queue_configure(ClientState *cs, XConfigureRequestEvent *cr) {
+    ClientCold *cc = cold(cs);
+    if (!cs->pending_configure) {
+        cc->pending_x = cs->x;
+        cc->pending_y = cs->y;
+        cc->pending_w = cs->w;
+        cc->pending_h = cs->h;
+        cs->pending_configure = 1;
+    }
+
+    if (cs->is_fullscreen || is_tiled(cs)) return;
+
+    if (cr->value_mask & CWX) cc->pending_x = cr->x - conf.border_width;
+    if (cr->value_mask & CWY) cc->pending_y = cr->y - conf.border_width - TITLE_HEIGHT;
+    if (cr->value_mask & CWWidth) cc->pending_w = cr->width;
+    if (cr->value_mask & CWHeight) cc->pending_h = cr->height + TITLE_HEIGHT;
+
+    if ((cr->value_mask & CWStackMode) && !(cr->value_mask & CWSibling) &&
+        cr->detail == Above) {
+        XRaiseWindow(dpy, cs->frame);
+        raise_bars();
+    }
+}
+
+void flush_configures(void) {
+    for (int i = 0; i < client_count; i++) {
+        ClientState *cs = &clients[i];
+        if (!cs->pending_configure) continue;
+        cs->pending_configure = 0;
+        ClientCold *cc = cold(cs);
+
+        if (cc->pending_x == cs->x && cc->pending_y == cs->y &&
+            cc->pending_w == cs->w && cc->pending_h == cs->h) {
+            send_configure_notify(cs);
+            continue;
+        }
+        configure_client(cs, cc->pending_x, cc->pending_y, cc->pending_w, cc->pending_h);
+    }
+}
+
+void set_fullscreen_state(ClientState *cs) {
+    if (cs->is_fullscreen) {
+        XChangeProperty(dpy, cs->client, wmatoms[NET_WM_STATE], XA_ATOM, 32, PropModeReplace,
+                        (unsigned char *)&wmatoms[NET_WM_STATE_FULLSCREEN], 1);
+    } else {
+        XDeleteProperty(dpy, cs->client, wmatoms[NET_WM_STATE]);
+    }
+}
+
+void toggle_fullscreen(Window client) {
+    ClientState *cs = get_client_state(client);
+    if (!cs || !cs->frame) return;
+    ClientCold *cc = cold(cs);
 
     int mon = cs->monitor;
     if (mon < 0 || mon >= monitor_count) mon = 0;
 
+    int w = cs->w, h = cs->h;
     if (!cs->is_fullscreen) {
-        XGetWindowAttributes(dpy, frame, &cs->old_attr);
-        XMoveResizeWindow(dpy, frame, 
-                          monitors[mon].x, monitors[mon].y,
-                          monitors[mon].w, monitors[mon].h);
-        XResizeWindow(dpy, client, monitors[mon].w, monitors[mon].h);
-        XRaiseWindow(dpy, frame);
+        save_restore_geometry(cs);
         cs->is_fullscreen = 1;
+        configure_client(cs, monitors[mon].x, monitors[mon].y,
+                         monitors[mon].w, monitors[mon].h);
+        XRaiseWindow(dpy, cs->frame);
     } else {
-        XMoveResizeWindow(dpy, frame, 
-                          cs->old_attr.x, cs->old_attr.y,
-                          cs->old_attr.width, cs->old_attr.height);
-        XResizeWindow(dpy, client, 
-                      cs->old_attr.width, 
-                      cs->old_attr.height - TITLE_HEIGHT);
         cs->is_fullscreen = 0;
+        configure_client(cs, cc->old_x, cc->old_y,
+                         cc->old_w, cc->old_h);
+    }
+    if (w == cs->w && h == cs->h) {
+        XMoveResizeWindow(dpy, cs->client, 0, client_top(cs), cs->w, cs->h - client_top(cs));
     }
+    set_fullscreen_state(cs);
+    mark_monitor_dirty(mon);
 }
 
 void snap_window(Window client, int direction) {
-    Window frame = get_frame(client);
-    if (!frame) return;
-
     ClientState *cs = get_client_state(client);
-    if (!cs || cs->is_fullscreen) return;
+    if (!cs || !cs->frame || cs->is_fullscreen || is_tiled(cs)) return;
+    ClientCold *cc = cold(cs);
 
     int mon = cs->monitor;
     if (mon < 0 || mon >= monitor_count) mon = 0;
@@ -538,8 +2456,6 @@ void snap_window(Window client, int direction) {
     int mw = monitors[mon].w;
     int mh = monitors[mon].h - BAR_HEIGHT;
 
-    XGetWindowAttributes(dpy, frame, &cs->old_attr);
-
     int x, y, w, h;
 
     switch (direction) {
@@ -562,29 +2478,242 @@ void snap_window(Window client, int direction) {
             h = mh;
             break;
         case 3:
-            x = cs->old_attr.x;
-            y = cs->old_attr.y;
-            w = cs->old_attr.width;
-            h = cs->old_attr.height;
+            if (cc->old_w <= 0 || cc->old_h <= 0) return;
+            x = cc->old_x;
+            y = cc->old_y;
+            w = cc->old_w;
+            h = cc->old_h;
             break;
         default:
             return;
     }
 
-    XMoveResizeWindow(dpy, frame, x, y, w, h);
-    XResizeWindow(dpy, client, w, h - TITLE_HEIGHT);
+    if (direction != 3) save_restore_geometry(cs);
+    configure_client(cs, x, y, w, h);
 }
 
-void raise_bars(void) {
-    for (int i = 0; i < monitor_count; i++) {
-        if (monitors[i].bar_win) {
-            XRaiseWindow(dpy, monitors[i].bar_win);
-        }
-    }
+void tile_place(ClientState *cs, int x, int y, int w, int h) {
+    w -= conf.border_width * 2;
+    h -= conf.border_width * 2;
+    if (w < 1) w = 1;
+    if (h < TITLE_HEIGHT + 1) h = TITLE_HEIGHT + 1;
+    if (cs->x == x && cs->y == y && cs->w == w && cs->h == h) return;
+    configure_client(cs, x, y, w, h);
 }
 
+void arrange_monitor(int mon) {
+    Monitor *m = &monitors[mon];
+    ClientState *tiled[MAX_CLIENTS];
+    int n = 0;
+
+    for (int i = 0; i < client_count; i++) {
+        ClientState *cs = &clients[i];
+        if (cs->monitor != mon || !is_tiled(cs) || !client_visible(cs)) continue;
+        if (start_ev.window && cs->frame == start_ev.window) continue;
+        int j = n++;
+        while (j > 0 && tiled[j - 1]->tile_order < cs->tile_order) {
+            tiled[j] = tiled[j - 1];
+            j--;
+        }
+        tiled[j] = cs;
+    }
+    if (n == 0) return;
+
+    int ax = m->x, ay = m->y + BAR_HEIGHT, aw = m->w, ah = m->h - BAR_HEIGHT;
+
+    if (m->layout == LAYOUT_TILE) {
+        if (n == 1) {
+            tile_place(tiled[0], ax, ay, aw, ah);
+            return;
+        }
+        int mw = aw * MASTER_RATIO / 100;
+        tile_place(tiled[0], ax, ay, mw, ah);
+        for (int i = 1; i < n; i++) {
+            int y0 = ah * (i - 1) / (n - 1);
+            int y1 = ah * i / (n - 1);
+            tile_place(tiled[i], ax + mw, ay + y0, aw - mw, y1 - y0);
+        }
+    } else {
+        int cols = 1;
+        while (cols * cols < n) cols++;
+        int rows = (n + cols - 1) / cols;
+        for (int i = 0; i < n; i++) {
+            int r = i / cols, c = i % cols;
+            int in_row = (r == rows - 1) ? n - r * cols : cols;
+            int x0 = aw * c / in_row, x1 = aw * (c + 1) / in_row;
+            int y0 = ah * r / rows, y1 = ah * (r + 1) / rows;
+            tile_place(tiled[i], ax + x0, ay + y0, x1 - x0, y1 - y0);
+        }
+    }
+}
+
+void set_layout(int mon, int layout) {
+    if (mon < 0 || mon >= monitor_count || monitors[mon].layout == layout) return;
+    monitors[mon].layout = layout;
+    mark_monitor_dirty(mon);
+}
+
+#ifdef HAVE_XFT
+int xft_advance(FcChar32 c) {
+    if (c < XFT_ADV_CACHE && xft_adv[c] >= 0) return xft_adv[c];
+
+    XGlyphInfo gi;
+    XftTextExtents32(dpy, xft_font, &c, 1, &gi);
+    if (c < XFT_ADV_CACHE) xft_adv[c] = gi.xOff;
+    return gi.xOff;
+}
+
+XftColor *xft_color(unsigned long pixel) {
+    Visual *vis = DefaultVisual(dpy, DefaultScreen(dpy));
+    Colormap cmap = DefaultColormap(dpy, DefaultScreen(dpy));
+
+    for (int i = 0; i < xft_color_count; i++) {
+        if (xft_colors[i].pixel == pixel) return &xft_colors[i].color;
+    }
+    if (xft_color_count == XFT_COLORS) {
+        for (int i = 0; i < xft_color_count; i++) XftColorFree(dpy, vis, cmap, &xft_colors[i].color);
+        xft_color_count = 0;
+    }
+
+    XColor xc = { .pixel = pixel };
+    XQueryColor(dpy, cmap, &xc);
+    XRenderColor rc = { xc.red, xc.green, xc.blue, 0xffff };
+    XftColor *c = &xft_colors[xft_color_count].color;
+    if (!XftColorAllocValue(dpy, vis, cmap, &rc, c)) return NULL;
+    xft_colors[xft_color_count++].pixel = pixel;
+    return c;
+}
+#endif
+
+XCharStruct *glyph_metrics(unsigned int c) {
+    XFontStruct *f = font_info;
+    if (f->min_byte1 != 0 || c < f->min_char_or_byte2 || c > f->max_char_or_byte2) return NULL;
+    XCharStruct *cs = &f->per_char[c - f->min_char_or_byte2];
+    if (!cs->width && !cs->lbearing && !cs->rbearing && !cs->ascent && !cs->descent) return NULL;
+    return cs;
+}
+
+void font_metrics(void) {
+    XFontStruct *f = font_info;
+
+    for (unsigned int c = 0; c < 256; c++) {
+        if (!f->per_char) {
+            glyph_w[c] = f->max_bounds.width;
+            continue;
+        }
+        XCharStruct *cs = glyph_metrics(c);
+        if (!cs) cs = glyph_metrics(f->default_char);
+        glyph_w[c] = cs ? cs->width : 0;
+    }
+    ellipsis_w = glyph_w['.'] * 3;
+#ifdef HAVE_XFT
+    if (xft_font) ellipsis_w = xft_advance('.') * 3;
+#endif
+}
+
+int text_char(const char *str, int len, int i, int *w) {
+#ifdef HAVE_XFT
+    if (xft_font) {
+        FcChar32 c;
+        int n = FcUtf8ToUcs4((const FcChar8 *)str + i, &c, len - i);
+        if (n <= 0) {
+            *w = 0;
+            return 1;
+        }
+        *w = xft_advance(c);
+        return n;
+    }
+#endif
+    (void)len;
+    *w = glyph_w[(unsigned char)str[i]];
+    return 1;
+}
+
+int font_ascent(void) {
+#ifdef HAVE_XFT
+    if (xft_font) return xft_font->ascent;
+#endif
+    return font_info->ascent;
+}
+
+int text_width(const char *str, int len) {
+    int w = 0, cw;
+    for (int i = 0; i < len; w += cw) i += text_char(str, len, i, &cw);
+    return w;
+}
+
+void draw_text(Drawable d, GC gc, int x, int y, const char *str, int len, unsigned long pixel) {
+#ifdef HAVE_XFT
+    XftColor *color;
+    if (xft_font && (color = xft_color(pixel))) {
+        if (!xft_draw) {
+            xft_draw = XftDrawCreate(dpy, d, DefaultVisual(dpy, DefaultScreen(dpy)),
+                                     DefaultColormap(dpy, DefaultScreen(dpy)));
+        } else {
+            XftDrawChange(xft_draw, d);
+        }
+        XftDrawStringUtf8(xft_draw, color, xft_font, x, y, (const FcChar8 *)str, len);
+        return;
+    }
+#endif
+    XSetForeground(dpy, gc, pixel);
+    XDrawString(dpy, d, gc, x, y, str, len);
+}
+
+int ellipsize(const char *str, char *out, size_t size, int max_w) {
+    int len = strlen(str);
+    if (len > (int)size - 4) len = size - 4;
+
+    int pos[len + 1], prefix[len + 1];
+    int n = 0, i = 0, cw;
+    pos[0] = prefix[0] = 0;
+    while (i < len) {
+        int step = text_char(str, len, i, &cw);
+        if (i + step > len) break;
+        i += step;
+        n++;
+        pos[n] = i;
+        prefix[n] = prefix[n - 1] + cw;
+    }
+
+    if (str[i] == '\0' && prefix[n] <= max_w) {
+        memcpy(out, str, i);
+        out[i] = '\0';
+        return i;
+    }
+
+    int lo = 0, hi = n;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (prefix[mid] + ellipsis_w <= max_w) lo = mid;
+        else hi = mid - 1;
+    }
+    memcpy(out, str, pos[lo]);
+    memcpy(out + pos[lo], "...", 4);
+    return pos[lo] + 3;
+}
+
+typedef struct {
+    int fd;
+    int fd2;
+    int pipe_fd;
+    long long next;
+    unsigned long long idle, total;
+    char text[256];
+    char out[256];
+    int out_len;
+    int overflow;
+} StatusSource;
+
+StatusSource status_src[MAX_STATUS];
+int status_active = 0;
+char status_text[512];
+int status_pending = 0;
+long long status_paint_at = 0;
+
 void update_bar(int mon) {
     if (!dpy || !font_info || mon < 0 || mon >= monitor_count) return;
+    if (monitors[mon].fullscreen) return;
 
     Window bar = monitors[mon].bar_win;
     if (!bar) return;
@@ -594,64 +2723,524 @@ void update_bar(int mon) {
 
     int w = monitors[mon].w;
 
-    XSetForeground(dpy, gc, get_pixel(conf.bar_color));
+    XSetForeground(dpy, gc, px.bar);
     XFillRectangle(dpy, bar, gc, 0, 0, w, BAR_HEIGHT);
 
-    char buffer[256];
-    char time_str[64];
-    time_t t = time(NULL);
-    struct tm *tm_info = localtime(&t);
-    if (tm_info) {
-        strftime(time_str, sizeof(time_str), "%H:%M | %d/%m", tm_info);
+    ClientState *fc = get_client_state(focus_window);
+    const char *win_name = (fc && cold(fc)->title[0]) ? cold(fc)->title : "Desktop";
+    const char *sep = conf.status_count ? " || " : "";
+
+    char buffer[320];
+    if (monitor_count > 1 && conf.workspaces > 1) {
+        snprintf(buffer, sizeof(buffer), "[%d:%d] %s%s",
+                 mon + 1, monitors[mon].workspace + 1, win_name, sep);
+    } else if (monitor_count > 1 || conf.workspaces > 1) {
+        snprintf(buffer, sizeof(buffer), "[%d] %s%s",
+                 monitor_count > 1 ? mon + 1 : monitors[mon].workspace + 1, win_name, sep);
     } else {
-        strcpy(time_str, "--:--");
+        snprintf(buffer, sizeof(buffer), "%s%s", win_name, sep);
     }
 
-    struct sysinfo info;
-    unsigned long long used = 0;
-    if (sysinfo(&info) == 0) {
-        unsigned long long total = (unsigned long long)info.totalram * info.mem_unit;
-        unsigned long long free_r = (unsigned long long)info.freeram * info.mem_unit;
-        used = (total - free_r) / 1024 / 1024;
+    int text_y = (BAR_HEIGHT / 2) + (font_ascent() / 2) - 1;
+    draw_text(bar, gc, 8, text_y, buffer, strlen(buffer), px.text);
+    monitors[mon].status_x = 8 + text_width(buffer, strlen(buffer));
+    draw_text(bar, gc, monitors[mon].status_x, text_y, status_text, strlen(status_text), px.text);
+
+    XSetForeground(dpy, gc, px.line);
+    XDrawLine(dpy, bar, gc, 0, BAR_HEIGHT - 1, w, BAR_HEIGHT - 1);
+
+    if (mon == active_monitor) {
+        XSetForeground(dpy, gc, px.active_border);
+        XFillRectangle(dpy, bar, gc, 0, 0, 4, BAR_HEIGHT);
     }
 
-    char *win_name = NULL;
-    if (focus_window) {
-        XFetchName(dpy, focus_window, &win_name);
+    XFreeGC(dpy, gc);
+}
+
+void update_all_bars(void) {
+    for (int i = 0; i < monitor_count; i++) {
+        update_bar(i);
     }
+}
 
-    if (monitor_count > 1) {
-        snprintf(buffer, sizeof(buffer), "[%d] %s || %s | RAM: %lluMB",
-                 mon + 1,
-                 win_name ? win_name : "Desktop", 
-                 time_str, used);
-    } else {
-        snprintf(buffer, sizeof(buffer), "%s || %s | RAM: %lluMB",
-                 win_name ? win_name : "Desktop", 
-                 time_str, used);
+void update_status_bars(void) {
+    if (!dpy || !font_info) return;
+
+    for (int i = 0; i < monitor_count; i++) {
+        Monitor *m = &monitors[i];
+        if (!m->bar_win || m->fullscreen) continue;
+        if (!m->status_x) {
+            update_bar(i);
+            continue;
+        }
+
+        GC gc = XCreateGC(dpy, m->bar_win, 0, NULL);
+        XSetFont(dpy, gc, font_info->fid);
+        XSetForeground(dpy, gc, px.bar);
+        XFillRectangle(dpy, m->bar_win, gc, m->status_x, 0, m->w - m->status_x, BAR_HEIGHT - 1);
+        int text_y = (BAR_HEIGHT / 2) + (font_ascent() / 2) - 1;
+        draw_text(m->bar_win, gc, m->status_x, text_y, status_text, strlen(status_text), px.text);
+        XFreeGC(dpy, gc);
     }
+}
 
-    if (win_name) XFree(win_name);
+int status_pread(int fd, char *buf, size_t size) {
+    if (fd < 0) return 0;
+    ssize_t n = pread(fd, buf, size - 1, 0);
+    if (n <= 0) return 0;
+    buf[n] = '\0';
+    return 1;
+}
 
-    XSetForeground(dpy, gc, get_pixel(conf.text_color));
-    int text_y = (BAR_HEIGHT / 2) + (font_info->ascent / 2) - 1;
-    XDrawString(dpy, bar, gc, 8, text_y, buffer, strlen(buffer));
+int status_set(StatusSource *src, const char *text) {
+    if (strcmp(src->text, text) == 0) return 0;
+    snprintf(src->text, sizeof(src->text), "%s", text);
+    return 1;
+}
 
-    XSetForeground(dpy, gc, get_pixel(conf.line_color));
-    XDrawLine(dpy, bar, gc, 0, BAR_HEIGHT - 1, w, BAR_HEIGHT - 1);
+void status_rebuild(void) {
+    char text[sizeof(status_text)];
+    int len = 0;
 
-    if (mon == active_monitor) {
-        XSetForeground(dpy, gc, get_pixel(conf.active_border_color));
-        XFillRectangle(dpy, bar, gc, 0, 0, 4, BAR_HEIGHT);
+    text[0] = '\0';
+    for (int i = 0; i < conf.status_count; i++) {
+        if (!status_src[i].text[0]) continue;
+        len += snprintf(text + len, sizeof(text) - len, "%s%s", len ? " | " : "", status_src[i].text);
+        if (len >= (int)sizeof(text)) break;
     }
+    if (strcmp(text, status_text) == 0) return;
+    memcpy(status_text, text, sizeof(status_text));
 
-    XFreeGC(dpy, gc);
+    long long now = now_ms();
+    if (now < status_paint_at) {
+        status_pending = 1;
+        return;
+    }
+    int rate = conf.bar_rate > 0 ? conf.bar_rate : 1;
+    status_paint_at = now + 1000 / rate;
+    status_pending = 0;
+    update_status_bars();
 }
 
-void update_all_bars(void) {
+void status_spawn(StatusSource *src, const char *cmd) {
+    int p[2];
+    if (pipe2(p, O_CLOEXEC) < 0) return;
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(p[1], STDOUT_FILENO);
+        if (dpy) close(ConnectionNumber(dpy));
+        setsid();
+        execl("/bin/sh", "sh", "-c", cmd, NULL);
+        _exit(127);
+    }
+    close(p[1]);
+    if (pid < 0) {
+        close(p[0]);
+        return;
+    }
+    fcntl(p[0], F_SETFL, O_NONBLOCK);
+    src->pipe_fd = p[0];
+    src->out_len = 0;
+}
+
+int status_update(int i) {
+    StatusSpec *st = &conf.status[i];
+    StatusSource *src = &status_src[i];
+    char buf[4096], text[96];
+    unsigned long long v[8] = {0};
+
+    text[0] = '\0';
+    switch (st->type) {
+    case STATUS_CLOCK: {
+        time_t t = time(NULL);
+        struct tm *tm_info = localtime(&t);
+        const char *fmt = st->arg[0] ? st->arg : "%H:%M";
+        if (!tm_info || !strftime(text, sizeof(text), fmt, tm_info)) strcpy(text, "--:--");
+        break;
+    }
+    case STATUS_MEM:
+        if (status_pread(src->fd, buf, sizeof(buf))) {
+            char *total = strstr(buf, "MemTotal:");
+            char *avail = strstr(buf, "MemAvailable:");
+            if (total && avail) {
+                unsigned long long used = strtoull(total + 9, NULL, 10) - strtoull(avail + 13, NULL, 10);
+                snprintf(text, sizeof(text), "RAM: %lluMB", used / 1024);
+            }
+        }
+        break;
+    case STATUS_CPU:
+        if (status_pread(src->fd, buf, 256) &&
+            sscanf(buf, "cpu %llu %llu %llu %llu %llu %llu %llu %llu",
+                   &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]) >= 4) {
+            unsigned long long total = 0, idle = v[3] + v[4];
+            for (int k = 0; k < 8; k++) total += v[k];
+            unsigned long long dt = total - src->total, di = idle - src->idle;
+            int first = !src->total;
+            src->total = total;
+            src->idle = idle;
+            if (!first) snprintf(text, sizeof(text), "CPU: %d%%", dt ? (int)((dt - di) * 100 / dt) : 0);
+        }
+        break;
+    case STATUS_LOAD:
+        if (status_pread(src->fd, buf, 64)) {
+            buf[strcspn(buf, " ")] = '\0';
+            snprintf(text, sizeof(text), "LOAD: %.16s", buf);
+        }
+        break;
+    case STATUS_BATTERY:
+        if (status_pread(src->fd, buf, 16)) {
+            char state[32] = "";
+            buf[strcspn(buf, "\n")] = '\0';
+            status_pread(src->fd2, state, sizeof(state));
+            snprintf(text, sizeof(text), "BAT: %.8s%%%s", buf,
+                     state[0] == 'C' ? "+" : state[0] == 'D' ? "-" : "");
+        }
+        break;
+    case STATUS_CMD:
+        if (src->pipe_fd < 0 && st->arg[0]) status_spawn(src, st->arg);
+        return 0;
+    case STATUS_FIFO:
+    case STATUS_ROOT:
+        src->next = LLONG_MAX;
+        return 0;
+    }
+    return status_set(src, text);
+}
+
+void status_close(void) {
+    for (int i = 0; i < status_active; i++) {
+        StatusSource *src = &status_src[i];
+        if (src->fd >= 0) close(src->fd);
+        if (src->fd2 >= 0) close(src->fd2);
+        if (src->pipe_fd >= 0) close(src->pipe_fd);
+        src->fd = src->fd2 = src->pipe_fd = -1;
+    }
+    status_active = 0;
+}
+
+long long status_tick(long long now) {
+    long long next = now + 60000;
+    int changed = 0;
+
+    for (int i = 0; i < conf.status_count; i++) {
+        StatusSource *src = &status_src[i];
+        if (now >= src->next) {
+            src->next = now + conf.status[i].interval;
+            changed |= status_update(i);
+        }
+        if (src->next < next) next = src->next;
+    }
+    if (changed) status_rebuild();
+    if (status_pending) {
+        if (now >= status_paint_at) {
+            int rate = conf.bar_rate > 0 ? conf.bar_rate : 1;
+            status_paint_at = now + 1000 / rate;
+            status_pending = 0;
+            update_status_bars();
+        } else if (status_paint_at < next) {
+            next = status_paint_at;
+        }
+    }
+    return next;
+}
+
+int status_root_name(void) {
+    int changed = 0;
+    char *name = NULL;
+
+    if (!XFetchName(dpy, root, &name)) name = NULL;
+    for (int i = 0; i < conf.status_count; i++) {
+        if (conf.status[i].type == STATUS_ROOT) changed |= status_set(&status_src[i], name ? name : "");
+    }
+    if (name) XFree(name);
+    return changed;
+}
+
+void status_init(void) {
+    char path[192];
+    long mask = ROOT_EVENT_MASK;
+
+    status_close();
+    for (int i = 0; i < conf.status_count; i++) {
+        StatusSource *src = &status_src[i];
+        memset(src, 0, sizeof(*src));
+        src->fd = src->fd2 = src->pipe_fd = -1;
+
+        StatusSpec *st = &conf.status[i];
+        switch (st->type) {
+        case STATUS_MEM:
+            src->fd = open("/proc/meminfo", O_RDONLY | O_CLOEXEC);
+            break;
+        case STATUS_CPU:
+            src->fd = open("/proc/stat", O_RDONLY | O_CLOEXEC);
+            break;
+        case STATUS_LOAD:
+            src->fd = open("/proc/loadavg", O_RDONLY | O_CLOEXEC);
+            break;
+        case STATUS_BATTERY: {
+            const char *bat = st->arg[0] ? st->arg : "BAT0";
+            snprintf(path, sizeof(path), "/sys/class/power_supply/%s/capacity", bat);
+            src->fd = open(path, O_RDONLY | O_CLOEXEC);
+            snprintf(path, sizeof(path), "/sys/class/power_supply/%s/status", bat);
+            src->fd2 = open(path, O_RDONLY | O_CLOEXEC);
+            break;
+        }
+        case STATUS_FIFO:
+            if (!st->arg[0]) break;
+            mkfifo(st->arg, 0600);
+            src->pipe_fd = open(st->arg, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+            src->fd2 = open(st->arg, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+            break;
+        case STATUS_ROOT:
+            mask |= PropertyChangeMask;
+            break;
+        }
+    }
+    status_active = conf.status_count;
+    status_text[0] = '\0';
+    if (dpy) {
+        XSelectInput(dpy, root, mask);
+        if (mask & PropertyChangeMask) status_root_name();
+    }
+    status_tick(now_ms());
+}
+
+void status_fill_fds(fd_set *fds, int *max_fd) {
+    for (int i = 0; i < conf.status_count; i++) {
+        int fd = status_src[i].pipe_fd;
+        if (fd < 0) continue;
+        FD_SET(fd, fds);
+        if (fd > *max_fd) *max_fd = fd;
+    }
+}
+
+int status_read_fifo(StatusSource *src) {
+    char buf[STATUS_FIFO_READ], line[sizeof(src->out)];
+    int got = 0;
+    ssize_t n;
+
+    if ((n = read(src->pipe_fd, buf, sizeof(buf))) > 0) {
+        for (ssize_t k = 0; k < n; k++) {
+            if (buf[k] == '\n') {
+                if (!src->overflow) {
+                    src->out[src->out_len] = '\0';
+                    memcpy(line, src->out, src->out_len + 1);
+                    got = 1;
+                }
+                src->out_len = 0;
+                src->overflow = 0;
+            } else if (src->out_len < (int)sizeof(src->out) - 1) {
+                src->out[src->out_len++] = buf[k] < 0x20 && buf[k] >= 0 ? ' ' : buf[k];
+            } else {
+                src->overflow = 1;
+            }
+        }
+    }
+    return got ? status_set(src, line) : 0;
+}
+
+void status_handle(fd_set *fds) {
+    int changed = 0;
+
+    for (int i = 0; i < conf.status_count; i++) {
+        StatusSource *src = &status_src[i];
+        if (src->pipe_fd < 0 || !FD_ISSET(src->pipe_fd, fds)) continue;
+
+        if (conf.status[i].type == STATUS_FIFO) {
+            changed |= status_read_fifo(src);
+            continue;
+        }
+
+        char buf[256];
+        ssize_t n;
+        while ((n = read(src->pipe_fd, buf, sizeof(buf))) > 0) {
+            int room = (int)sizeof(src->out) - 1 - src->out_len;
+            if (n > room) n = room;
+            memcpy(src->out + src->out_len, buf, n);
+            src->out_len += n;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EINTR)) continue;
+
+        close(src->pipe_fd);
+        src->pipe_fd = -1;
+        src->out[src->out_len] = '\0';
+        src->out[strcspn(src->out, "\n")] = '\0';
+        changed |= status_set(src, src->out);
+    }
+    if (changed) status_rebuild();
+}
+
+void update_fullscreen_mode(int mon) {
+    Monitor *m = &monitors[mon];
+    ClientState *fs = NULL;
+
+    for (int i = 0; i < client_count; i++) {
+        ClientState *cs = &clients[i];
+        if (cs->monitor != mon || !cs->frame || !cs->is_fullscreen || !client_visible(cs)) continue;
+        if (!fs || cs->last_focus > fs->last_focus) fs = cs;
+    }
+
+    Window frame = fs ? fs->frame : 0;
+    if (frame == m->fullscreen) return;
+
+    if (frame && !m->fullscreen && m->bar_win) XUnmapWindow(dpy, m->bar_win);
+    if (frame) XRaiseWindow(dpy, frame);
+    m->fullscreen = frame;
+    if (frame) return;
+    if (m->bar_win) {
+        XMapRaised(dpy, m->bar_win);
+        update_bar(mon);
+    }
+    for (int i = 0; i < client_count; i++) {
+        ClientState *cs = &clients[i];
+        if (cs->monitor != mon || !cs->deco_dirty) continue;
+        cs->deco_dirty = 0;
+        if (client_visible(cs)) XClearArea(dpy, cs->frame, 0, 0, 0, 0, True);
+    }
+}
+
+void flush_monitors(void) {
     for (int i = 0; i < monitor_count; i++) {
-        update_bar(i);
+        if (!monitors[i].dirty) continue;
+        monitors[i].dirty = 0;
+        update_fullscreen_mode(i);
+        if (monitors[i].layout != LAYOUT_FLOAT) arrange_monitor(i);
+    }
+}
+
+void update_desktop_hints(void) {
+    long n = conf.workspaces;
+    long cur = 0;
+    snapshot_dirty = 1;
+    if (active_monitor >= 0 && active_monitor < monitor_count) cur = monitors[active_monitor].workspace;
+    XChangeProperty(dpy, root, wmatoms[NET_NUMBER_OF_DESKTOPS], XA_CARDINAL, 32,
+                    PropModeReplace, (unsigned char *)&n, 1);
+    XChangeProperty(dpy, root, wmatoms[NET_CURRENT_DESKTOP], XA_CARDINAL, 32,
+                    PropModeReplace, (unsigned char *)&cur, 1);
+}
+
+void set_active_monitor(int mon) {
+    if (mon == active_monitor) return;
+    active_monitor = mon;
+    update_desktop_hints();
+}
+
+void sync_visibility(ClientState *cs) {
+    if (!cs->frame || cs->is_hidden) return;
+    int off = !on_current_workspace(cs);
+    if (off == cs->ws_hidden) return;
+    cs->ws_hidden = off;
+    if (off) {
+        XUnmapWindow(dpy, cs->frame);
+        XUnmapWindow(dpy, cs->client);
+        cold(cs)->ignore_unmap++;
+        set_wm_state(cs->client, IconicState);
+    } else {
+        XMapWindow(dpy, cs->client);
+        XMapWindow(dpy, cs->frame);
+        set_wm_state(cs->client, NormalState);
+    }
+    grid_update(cs);
+    mark_monitor_dirty(cs->monitor);
+}
+
+void focus_client(ClientState *cs) {
+    if (!cs) {
+        focus_window = 0;
+        XSetInputFocus(dpy, PointerRoot, RevertToPointerRoot, CurrentTime);
+        set_active_window(None);
+        return;
+    }
+    XSetInputFocus(dpy, cs->client, RevertToPointerRoot, CurrentTime);
+    focus_window = cs->client;
+    set_active_monitor(cs->monitor);
+    set_active_window(focus_window);
+}
+
+ClientState *last_focused_on(int mon) {
+    ClientState *best = NULL;
+    for (int i = 0; i < client_count; i++) {
+        ClientState *cs = &clients[i];
+        if (cs->monitor != mon || !cs->frame || !client_visible(cs)) continue;
+        if (!best || cs->last_focus > best->last_focus) best = cs;
+    }
+    return best;
+}
+
+void switch_workspace(int mon, int ws) {
+    if (mon < 0 || mon >= monitor_count || ws < 0 || ws >= conf.workspaces) return;
+    if (monitors[mon].workspace == ws) return;
+    monitors[mon].workspace = ws;
+
+    for (int i = 0; i < client_count; i++) {
+        if (clients[i].monitor == mon) sync_visibility(&clients[i]);
+    }
+
+    ClientState *fc = get_client_state(focus_window);
+    if (mon == active_monitor || (fc && !client_visible(fc))) {
+        focus_client(last_focused_on(mon));
+        set_active_monitor(mon);
+    }
+    update_desktop_hints();
+    update_all_bars();
+}
+
+void move_to_workspace(ClientState *cs, int ws) {
+    if (!cs || !cs->frame || ws < 0 || ws >= conf.workspaces || cs->workspace == ws) return;
+    cs->workspace = ws;
+    cs->due |= DUE_SESSION;
+    set_client_desktop(cs);
+    sync_visibility(cs);
+
+    if (cs->client == focus_window && !client_visible(cs)) {
+        focus_client(last_focused_on(cs->monitor));
+        update_all_bars();
+    }
+}
+
+void activate_client(ClientState *cs) {
+    if (!cs || !cs->frame) return;
+    if (!on_current_workspace(cs)) switch_workspace(cs->monitor, cs->workspace);
+    Window fs = monitors[cs->monitor].fullscreen;
+    if (fs && fs != cs->frame) toggle_fullscreen(find_client_in_frame(fs));
+    show_client(cs);
+    cs->tile_order = ++tile_serial;
+    mark_monitor_dirty(cs->monitor);
+    XRaiseWindow(dpy, cs->frame);
+    raise_bars();
+    focus_client(cs);
+}
+
+void draw_title(ClientState *cs, Window frame, GC gc, int x, unsigned long fg) {
+    ClientCold *cc = cold(cs);
+    int ty = TITLE_HEIGHT / 2 + font_ascent() / 2 - 1;
+#ifdef HAVE_XFT
+    if (xft_font) {
+        int h = TITLE_HEIGHT - 2;
+        if (!cc->title_pix_valid || cc->title_pix_fg != fg || cc->title_pix_bg != px.bar) {
+            int w = text_width(cc->title_fit, cc->title_fit_len);
+            if (w < 1) w = 1;
+            if (cc->title_pix && cc->title_pix_w != w) {
+                XFreePixmap(dpy, cc->title_pix);
+                cc->title_pix = 0;
+            }
+            if (!cc->title_pix) {
+                cc->title_pix = XCreatePixmap(dpy, frame, w, h, DefaultDepth(dpy, DefaultScreen(dpy)));
+            }
+            XSetForeground(dpy, gc, px.bar);
+            XFillRectangle(dpy, cc->title_pix, gc, 0, 0, w, h);
+            draw_text(cc->title_pix, gc, 0, ty - 1, cc->title_fit, cc->title_fit_len, fg);
+            cc->title_pix_w = w;
+            cc->title_pix_fg = fg;
+            cc->title_pix_bg = px.bar;
+            cc->title_pix_valid = 1;
+        }
+        XCopyArea(dpy, cc->title_pix, frame, gc, 0, 0, cc->title_pix_w, h, x, 1);
+        return;
     }
+#endif
+    draw_text(frame, gc, x, ty, cc->title_fit, cc->title_fit_len, fg);
 }
 
 void draw_decorations(Window frame, int width, int height) {
@@ -662,11 +3251,11 @@ void draw_decorations(Window frame, int width, int height) {
     GC gc = XCreateGC(dpy, frame, 0, NULL);
 
     int is_focused = (cs && cs->client == focus_window);
-    unsigned long bar_px = get_pixel(conf.bar_color);
-    unsigned long btn_px = get_pixel(conf.button_color);
+    unsigned long bar_px = px.bar;
+    unsigned long btn_px = px.button;
     unsigned long bdr_px = is_focused ? 
-        get_pixel(conf.active_border_color) : get_pixel(conf.border_color);
-    unsigned long line_px = get_pixel(conf.line_color);
+        px.active_border : px.border;
+    unsigned long line_px = px.line;
 
     XSetForeground(dpy, gc, bar_px);
     XFillRectangle(dpy, frame, gc, 0, 0, width, TITLE_HEIGHT);
@@ -697,36 +3286,425 @@ void draw_decorations(Window frame, int width, int height) {
     XDrawLine(dpy, frame, gc, xr + 8, 10, cx, cy);
     XDrawLine(dpy, frame, gc, xr + btn - 8, 10, cx, cy);
 
+    int tx = btn + 8;
+    Pixmap icon = cs ? icon_pixmap(cs, ICON_TITLE, bar_px) : None;
+    if (icon) {
+        int size = icon_px[ICON_TITLE];
+        XCopyArea(dpy, icon, frame, gc, 0, 0, size, size, tx - 2, (TITLE_HEIGHT - size) / 2);
+        tx += size + 4;
+    }
+
     if (cs && font_info) {
-        char *name = NULL;
-        XFetchName(dpy, cs->client, &name);
-        if (name) {
-            XSetForeground(dpy, gc, get_pixel(conf.text_color));
+        ClientCold *cc = cold(cs);
+        const char *name = cc->title;
+        if (name[0]) {
             XSetFont(dpy, gc, font_info->fid);
-            int ty = TITLE_HEIGHT / 2 + font_info->ascent / 2 - 1;
-            int max_w = width - btn * 2 - 20;
-            
-            char display[256];
-            strncpy(display, name, sizeof(display) - 1);
-            display[sizeof(display) - 1] = '\0';
-            
-            size_t len = strlen(display);
-            while (len > 3 && XTextWidth(font_info, display, len) > max_w) {
-                display[len - 4] = '.';
-                display[len - 3] = '.';
-                display[len - 2] = '.';
-                display[len - 1] = '\0';
-                len--;
+            int max_w = width - btn - tx - 12;
+
+            if (cc->title_fit_w != max_w) {
+                cc->title_fit_len = ellipsize(name, cc->title_fit, sizeof(cc->title_fit), max_w);
+                cc->title_fit_w = max_w;
+#ifdef HAVE_XFT
+                cc->title_pix_valid = 0;
+#endif
             }
-            
-            XDrawString(dpy, frame, gc, btn + 8, ty, display, strlen(display));
-            XFree(name);
+            draw_title(cs, frame, gc, tx, cc->unresponsive ? px.dim : px.text);
         }
     }
 
     XFreeGC(dpy, gc);
 }
 
+void redraw_decorations(ClientState *cs) {
+    if (!cs->frame || cs->ws_hidden || cs->is_hidden) return;
+    if (cs->monitor >= 0 && cs->monitor < monitor_count && monitors[cs->monitor].fullscreen &&
+        monitors[cs->monitor].fullscreen != cs->frame) {
+        cs->deco_dirty = 1;
+        return;
+    }
+    cs->deco_dirty = 0;
+    draw_decorations(cs->frame, cs->w, cs->h - TITLE_HEIGHT);
+}
+
+void title_deliver(ClientState *cs) {
+    if (!fetch_title(cs)) return;
+    redraw_decorations(cs);
+    if (cs->client == focus_window) update_all_bars();
+    ipc_event("title 0x%lx %s\n", cs->client, cold(cs)->title);
+}
+
+int title_refill(ClientState *cs, long long now) {
+    ClientCold *cc = cold(cs);
+    long long credit = cc->title_credit + (now - cc->title_refill);
+    if (credit > TITLE_BURST * TITLE_COST_MS) credit = TITLE_BURST * TITLE_COST_MS;
+    cc->title_refill = now;
+    cc->title_credit = credit;
+    return credit >= TITLE_COST_MS;
+}
+
+void title_changed(ClientState *cs, long long now) {
+    ClientCold *cc = cold(cs);
+    int ready = title_refill(cs, now);
+    if (cc->title_due) {
+        cc->title_coalesced++;
+        titles_coalesced++;
+        return;
+    }
+    if (!ready) {
+        cc->title_due = now + TITLE_COST_MS - cc->title_credit;
+        cs->due |= DUE_TITLE;
+        return;
+    }
+    cc->title_credit -= TITLE_COST_MS;
+    title_deliver(cs);
+}
+
+long long title_tick(long long now) {
+    long long next = 0;
+    for (int i = 0; i < client_count; i++) {
+        ClientState *cs = &clients[i];
+        if (!(cs->due & DUE_TITLE)) continue;
+        ClientCold *cc = cold(cs);
+        if (now >= cc->title_due) {
+            cc->title_due = 0;
+            cs->due &= ~DUE_TITLE;
+            title_refill(cs, now);
+            cc->title_credit = cc->title_credit > TITLE_COST_MS ? cc->title_credit - TITLE_COST_MS : 0;
+            title_deliver(cs);
+        } else if (!next || cc->title_due < next) {
+            next = cc->title_due;
+        }
+    }
+    return next;
+}
+
+void withdraw_client(ClientState *cs) {
+    Window client = cs->client;
+
+    set_wm_state(client, WithdrawnState);
+    if (cs->frame) {
+        XReparentWindow(dpy, client, root, cs->x, cs->y + client_top(cs));
+        XRemoveFromSaveSet(dpy, client);
+        XDestroyWindow(dpy, cs->frame);
+    }
+    remove_client(client);
+    update_client_list();
+
+    if (focus_window == client) {
+        focus_window = 0;
+        update_all_bars();
+    }
+}
+
+void grab_client_buttons(Window client) {
+    XGrabButton(dpy, Button1, mouse_mod_mask, client, False, ButtonPressMask,
+                GrabModeSync, GrabModeAsync, None, None);
+    XGrabButton(dpy, Button3, mouse_mod_mask, client, False, ButtonPressMask,
+                GrabModeSync, GrabModeAsync, None, None);
+    XGrabButton(dpy, Button1, mouse_mod_mask | Mod2Mask, client, False, ButtonPressMask,
+                GrabModeSync, GrabModeAsync, None, None);
+    XGrabButton(dpy, Button3, mouse_mod_mask | Mod2Mask, client, False, ButtonPressMask,
+                GrabModeSync, GrabModeAsync, None, None);
+}
+
+int rule_field_match(const char *pattern, const char *value) {
+    if (pattern[0] == '*' && pattern[1] == '\0') return 1;
+    return fnmatch(pattern, value ? value : "", 0) == 0;
+}
+
+const Rule *match_rule(Window client, const XClassHint *ch) {
+    if (ruleset.count == 0) return NULL;
+
+    char *title = NULL;
+    XFetchName(dpy, client, &title);
+
+    const Rule *best = NULL;
+    if (ch->res_class) {
+        unsigned int h = rule_hash(ch->res_class);
+        for (int i = ruleset.bucket[h % RULE_BUCKETS]; i >= 0; i = ruleset.rules[i].next) {
+            const Rule *r = &ruleset.rules[i];
+            if (r->hash == h && strcmp(r->class, ch->res_class) == 0 &&
+                rule_field_match(r->instance, ch->res_name) &&
+                rule_field_match(r->title, title)) {
+                best = r;
+                break;
+            }
+        }
+    }
+    for (int i = 0; i < ruleset.wild_count; i++) {
+        const Rule *r = &ruleset.rules[ruleset.wild[i]];
+        if (best && r > best) break;
+        if (rule_field_match(r->class, ch->res_class) &&
+            rule_field_match(r->instance, ch->res_name) &&
+            rule_field_match(r->title, title)) {
+            best = r;
+            break;
+        }
+    }
+
+    if (title) XFree(title);
+    return best;
+}
+
+void session_open(void) {
+    const char *home = getenv("HOME");
+    if (!home) return;
+
+    char path[256];
+    snprintf(path, sizeof(path), "%s/.cache", home);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/.cache/lwm.session", home);
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) return;
+
+    session_size = sizeof(SessionHeader) + sizeof(SessionRecord) * SESSION_SLOTS;
+    if (ftruncate(fd, session_size) < 0) {
+        close(fd);
+        return;
+    }
+    void *map = mmap(NULL, session_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return;
+
+    session_hdr = map;
+    session_recs = (SessionRecord *)(session_hdr + 1);
+
+    if (session_hdr->magic != SESSION_MAGIC || session_hdr->version != SESSION_VERSION ||
+        session_hdr->record_size != sizeof(SessionRecord) || session_hdr->slots != SESSION_SLOTS) {
+        memset(map, 0, session_size);
+        session_hdr->record_size = sizeof(SessionRecord);
+        session_hdr->slots = SESSION_SLOTS;
+        session_hdr->version = SESSION_VERSION;
+        __atomic_store_n(&session_hdr->magic, SESSION_MAGIC, __ATOMIC_RELEASE);
+    }
+}
+
+void session_close(void) {
+    if (session_hdr) munmap(session_hdr, session_size);
+    session_hdr = NULL;
+    session_recs = NULL;
+}
+
+int session_read(const SessionRecord *r, SessionRecord *out) {
+    for (int tries = 0; tries < 64; tries++) {
+        unsigned int seq = __atomic_load_n(&r->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) continue;
+        memcpy(out, r, sizeof(*out));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&r->seq, __ATOMIC_RELAXED) == seq) return 1;
+    }
+    return 0;
+}
+
+void session_write(SessionRecord *r, const SessionRecord *src) {
+    unsigned int seq = r->seq;
+    __atomic_store_n(&r->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    r->hash = src->hash;
+    r->used = ++session_hdr->clock;
+    memcpy(r->key, src->key, sizeof(r->key));
+    r->x = src->x;
+    r->y = src->y;
+    r->w = src->w;
+    r->h = src->h;
+    r->workspace = src->workspace;
+    r->fullscreen = src->fullscreen;
+    r->hidden = src->hidden;
+    __atomic_store_n(&r->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+int session_key(Window client, const XClassHint *ch, char *key, size_t size) {
+    if (!ch->res_class) return 0;
+
+    char *role = NULL;
+    XTextProperty tp;
+    if (XGetTextProperty(dpy, client, &tp, wmatoms[WM_WINDOW_ROLE]) && tp.value) {
+        role = (char *)tp.value;
+    }
+    snprintf(key, size, "%s/%s/%s", ch->res_class, ch->res_name ? ch->res_name : "",
+             role ? role : "");
+    if (role) XFree(role);
+    return 1;
+}
+
+int session_find(const char *key, int create) {
+    if (!session_recs) return -1;
+
+    unsigned int h = rule_hash(key);
+    int victim = -1;
+    for (int i = 0; i < SESSION_PROBE; i++) {
+        int slot = (h + i) % SESSION_SLOTS;
+        SessionRecord *r = &session_recs[slot];
+        if (r->key[0] == '\0') {
+            victim = slot;
+            break;
+        }
+        if (r->hash == h && strcmp(r->key, key) == 0) return slot;
+        if (victim < 0 || r->used < session_recs[victim].used) victim = slot;
+    }
+    if (!create || victim < 0) return -1;
+
+    for (int i = 0; i < client_count; i++) {
+        if (cold(&clients[i])->session_slot == victim) cold(&clients[i])->session_slot = -1;
+    }
+
+    SessionRecord rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.hash = h;
+    strncpy(rec.key, key, sizeof(rec.key) - 1);
+    session_write(&session_recs[victim], &rec);
+    return victim;
+}
+
+void session_flush(void) {
+    if (!session_recs) return;
+
+    for (int i = 0; i < client_count; i++) {
+        ClientState *cs = &clients[i];
+        if (!(cs->due & DUE_SESSION)) continue;
+        if (start_ev.window && cs->frame == start_ev.window) continue;
+        cs->due &= ~DUE_SESSION;
+        ClientCold *cc = cold(cs);
+        if (cc->session_slot < 0) continue;
+
+        SessionRecord *r = &session_recs[cc->session_slot];
+        SessionRecord rec = *r;
+        if (cs->is_fullscreen) {
+            rec.x = cc->old_x;
+            rec.y = cc->old_y;
+            rec.w = cc->old_w;
+            rec.h = cc->old_h;
+        } else {
+            rec.x = cs->x;
+            rec.y = cs->y;
+            rec.w = cs->w;
+            rec.h = cs->h;
+        }
+        rec.workspace = cs->workspace;
+        rec.fullscreen = cs->is_fullscreen;
+        rec.hidden = cs->is_hidden;
+        if (rec.x == r->x && rec.y == r->y && rec.w == r->w && rec.h == r->h &&
+            rec.workspace == r->workspace && rec.fullscreen == r->fullscreen &&
+            rec.hidden == r->hidden) continue;
+        session_write(r, &rec);
+    }
+}
+
+void snapshot_open(void) {
+    const char *dir = getenv("XDG_RUNTIME_DIR");
+    if (dir) snprintf(snapshot_path, sizeof(snapshot_path), "%s/lwm.state", dir);
+    else snprintf(snapshot_path, sizeof(snapshot_path), "/dev/shm/lwm-%d.state", (int)getuid());
+
+    int fd = open(snapshot_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) return;
+
+    snapshot_size = sizeof(SnapshotHeader) + sizeof(SnapshotClient) * MAX_CLIENTS +
+                    sizeof(SnapshotMonitor) * SNAPSHOT_MONITORS;
+    if (ftruncate(fd, snapshot_size) < 0) {
+        close(fd);
+        return;
+    }
+    void *map = mmap(NULL, snapshot_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return;
+
+    snapshot_hdr = map;
+    unsigned int seq = snapshot_hdr->magic == SNAPSHOT_MAGIC ? snapshot_hdr->seq : 0;
+    __atomic_store_n(&snapshot_hdr->seq, (seq + 1) | 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    snapshot_hdr->version = SNAPSHOT_VERSION;
+    snapshot_hdr->header_size = sizeof(SnapshotHeader);
+    snapshot_hdr->client_size = sizeof(SnapshotClient);
+    snapshot_hdr->monitor_size = sizeof(SnapshotMonitor);
+    snapshot_hdr->max_clients = MAX_CLIENTS;
+    snapshot_hdr->max_monitors = SNAPSHOT_MONITORS;
+    snapshot_hdr->client_count = 0;
+    snapshot_hdr->monitor_count = 0;
+    snapshot_hdr->magic = SNAPSHOT_MAGIC;
+    __atomic_store_n(&snapshot_hdr->seq, ((seq + 1) | 1) + 1, __ATOMIC_RELEASE);
+    snapshot_dirty = 1;
+    setenv("LWM_STATE", snapshot_path, 1);
+}
+
+void snapshot_close(void) {
+    if (!snapshot_hdr) return;
+    if (!restarting) {
+        __atomic_store_n(&snapshot_hdr->magic, 0, __ATOMIC_RELEASE);
+        unlink(snapshot_path);
+    }
+    munmap(snapshot_hdr, snapshot_size);
+    snapshot_hdr = NULL;
+}
+
+void snapshot_flush(void) {
+    if (!snapshot_hdr || !snapshot_dirty) return;
+    snapshot_dirty = 0;
+
+    SnapshotHeader *h = snapshot_hdr;
+    SnapshotClient *sc = (SnapshotClient *)(h + 1);
+    SnapshotMonitor *sm = (SnapshotMonitor *)(sc + MAX_CLIENTS);
+    unsigned int seq = h->seq;
+
+    __atomic_store_n(&h->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    int n = 0;
+    for (int i = 0; i < client_count; i++) {
+        ClientState *cs = &clients[i];
+        if (!cs->frame) continue;
+        SnapshotClient *c = &sc[n++];
+        c->client = cs->client;
+        c->frame = cs->frame;
+        c->last_focus = cs->last_focus;
+        c->x = cs->x;
+        c->y = cs->y;
+        c->w = cs->w;
+        c->h = cs->h;
+        c->monitor = cs->monitor;
+        c->workspace = cs->workspace;
+        c->hidden = cs->is_hidden;
+        c->fullscreen = cs->is_fullscreen;
+        c->title_coalesced = cold(cs)->title_coalesced;
+        memcpy(c->title, cold(cs)->title, sizeof(c->title));
+    }
+    h->client_count = n;
+
+    int m = monitor_count < SNAPSHOT_MONITORS ? monitor_count : SNAPSHOT_MONITORS;
+    for (int i = 0; i < m; i++) {
+        sm[i].x = monitors[i].x;
+        sm[i].y = monitors[i].y;
+        sm[i].w = monitors[i].w;
+        sm[i].h = monitors[i].h;
+        sm[i].workspace = monitors[i].workspace;
+        sm[i].layout = monitors[i].layout;
+        sm[i].fullscreen = monitors[i].fullscreen;
+    }
+    h->monitor_count = m;
+    h->active_monitor = active_monitor;
+    h->titles_coalesced = titles_coalesced;
+    h->thumb_count = thumb_count;
+    h->thumb_bytes = thumb_bytes;
+    h->focus = focus_window;
+
+    __atomic_store_n(&h->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void session_attach(ClientState *cs) {
+    ClientCold *cc = cold(cs);
+    XClassHint ch = { NULL, NULL };
+    char key[128];
+
+    cc->session_slot = -1;
+    if (!XGetClassHint(dpy, cs->client, &ch)) return;
+    if (ch.res_class) snprintf(cc->wm_class, sizeof(cc->wm_class), "%s", ch.res_class);
+    if (session_recs && session_key(cs->client, &ch, key, sizeof(key))) {
+        cc->session_slot = session_find(key, 1);
+    }
+    if (ch.res_class) XFree(ch.res_class);
+    if (ch.res_name) XFree(ch.res_name);
+}
+
 void frame_window(Window client) {
     if (!dpy || !client) return;
     if (get_frame(client)) return;
@@ -757,6 +3735,7 @@ void frame_window(Window client) {
 
     if (!should_frame) {
         XMapWindow(dpy, client);
+        set_wm_state(client, NormalState);
         add_client(client, 0, 0);
         update_client_list();
         return;
@@ -770,56 +3749,159 @@ void frame_window(Window client) {
     
     int mon = get_monitor_at(root_x, root_y);
 
+    XClassHint ch = { NULL, NULL };
+    char wm_class[64] = "";
+    XGetClassHint(dpy, client, &ch);
+    if (ch.res_class) snprintf(wm_class, sizeof(wm_class), "%s", ch.res_class);
+    const Rule *rule = match_rule(client, &ch);
+
+    char key[128];
+    int have_key = session_key(client, &ch, key, sizeof(key));
+    int slot = have_key ? session_find(key, 0) : -1;
+    for (int i = 0; i < client_count && slot >= 0; i++) {
+        if (cold(&clients[i])->session_slot == slot) slot = -1;
+    }
+
+    SessionRecord saved;
+    memset(&saved, 0, sizeof(saved));
+    if (!rule && slot >= 0 && session_read(&session_recs[slot], &saved) &&
+        saved.w >= MIN_SIZE && saved.h > TITLE_HEIGHT) {
+        int cx = saved.x + saved.w / 2, cy = saved.y + saved.h / 2;
+        mon = get_monitor_at(cx, cy);
+        if (cx < monitors[mon].x || cx >= monitors[mon].x + monitors[mon].w ||
+            cy < monitors[mon].y || cy >= monitors[mon].y + monitors[mon].h) {
+            memset(&saved, 0, sizeof(saved));
+        }
+    } else {
+        memset(&saved, 0, sizeof(saved));
+    }
+    if (ch.res_class) XFree(ch.res_class);
+    if (ch.res_name) XFree(ch.res_name);
+
+    if (rule && rule->monitor >= 0 && rule->monitor < monitor_count) mon = rule->monitor;
+    Monitor *m = &monitors[mon];
+
     int w = attrs.width;
     int h = attrs.height;
-    if (w < MIN_SIZE || h < MIN_SIZE) {
+    int has_pos = 0;
+    int x = 0, y = 0;
+    if (saved.w) {
+        w = saved.w;
+        h = saved.h - TITLE_HEIGHT;
+        x = saved.x;
+        y = saved.y;
+        has_pos = 1;
+    }
+    if (rule && rule->w >= MIN_SIZE && rule->h >= MIN_SIZE) {
+        w = rule->w;
+        h = rule->h;
+    } else if (w < MIN_SIZE || h < MIN_SIZE) {
         w = DEFAULT_WINDOW_WIDTH;
         h = DEFAULT_WINDOW_HEIGHT;
-        XResizeWindow(dpy, client, w, h);
     }
 
-    int mx = monitors[mon].x;
-    int my = monitors[mon].y + BAR_HEIGHT;
-    int mw = monitors[mon].w;
-    int mh = monitors[mon].h - BAR_HEIGHT;
+    if (rule && rule->has_pos) {
+        x = m->x + rule->x;
+        y = m->y + rule->y;
+    } else if (!has_pos) {
+        place_window(mon, w + conf.border_width * 2, h + TITLE_HEIGHT + conf.border_width * 2,
+                     &x, &y);
+    }
 
-    int x = mx + (mw - w) / 2;
-    int y = my + (mh - h) / 2;
-    if (y < my) y = my;
+    int fullscreen = rule ? rule->fullscreen : saved.fullscreen;
+    int hidden = rule ? rule->hidden : saved.hidden;
+    int ws = m->workspace;
+    if (rule && rule->workspace >= 0 && rule->workspace < conf.workspaces) ws = rule->workspace;
+    else if (saved.w && saved.workspace >= 0 && saved.workspace < conf.workspaces) ws = saved.workspace;
+    int visible = !hidden && ws == m->workspace;
+
+    int fx = x, fy = y, fw = w, fh = h + TITLE_HEIGHT, top = TITLE_HEIGHT;
+    if (fullscreen) {
+        fx = m->x;
+        fy = m->y;
+        fw = m->w;
+        fh = m->h;
+        top = 0;
+    }
+    if (fw != attrs.width || fh - top != attrs.height) XResizeWindow(dpy, client, fw, fh - top);
 
-    Window frame = XCreateSimpleWindow(dpy, root, x, y, w, h + TITLE_HEIGHT, 
+    Window frame = XCreateSimpleWindow(dpy, root, fx, fy, fw, fh, 
                                        conf.border_width,
-                                       get_pixel(conf.border_color), 
-                                       get_pixel(conf.bar_color));
+                                       px.border, 
+                                       px.bar);
 
-    XSelectInput(dpy, client, StructureNotifyMask | PropertyChangeMask);
-    XSelectInput(dpy, frame, SubstructureRedirectMask | SubstructureNotifyMask |
-                 ButtonPressMask | ButtonReleaseMask | ExposureMask | EnterWindowMask);
+    XSelectInput(dpy, client, CLIENT_EVENT_MASK);
+    XSelectInput(dpy, frame, FRAME_EVENT_MASK);
     
-    XReparentWindow(dpy, client, frame, 0, TITLE_HEIGHT);
-    XMapWindow(dpy, frame);
-    XMapWindow(dpy, client);
+    XReparentWindow(dpy, client, frame, 0, top);
     XAddToSaveSet(dpy, client);
+    grab_client_buttons(client);
 
-    XGrabButton(dpy, Button1, mouse_mod_mask, client, False, ButtonPressMask,
-                GrabModeSync, GrabModeAsync, None, None);
-    XGrabButton(dpy, Button3, mouse_mod_mask, client, False, ButtonPressMask,
-                GrabModeSync, GrabModeAsync, None, None);
-    XGrabButton(dpy, Button1, mouse_mod_mask | Mod2Mask, client, False, ButtonPressMask,
-                GrabModeSync, GrabModeAsync, None, None);
-    XGrabButton(dpy, Button3, mouse_mod_mask | Mod2Mask, client, False, ButtonPressMask,
-                GrabModeSync, GrabModeAsync, None, None);
+    add_client(client, frame, mon);
+    update_client_list();
+
+    ClientState *cs = get_client_state(client);
+    if (cs) {
+        cs->x = fx;
+        cs->y = fy;
+        cs->w = fw;
+        cs->h = fh;
+        cs->workspace = ws;
+        cs->is_hidden = hidden;
+        cs->ws_hidden = !hidden && !visible;
+        cs->is_fullscreen = fullscreen;
+        if (fullscreen) {
+            cold(cs)->old_x = x;
+            cold(cs)->old_y = y;
+            cold(cs)->old_w = w;
+            cold(cs)->old_h = h + TITLE_HEIGHT;
+            set_fullscreen_state(cs);
+        }
+        cs->tile_order = ++tile_serial;
+        cold(cs)->session_slot = slot >= 0 ? slot : (have_key ? session_find(key, 1) : -1);
+        cs->due |= DUE_SESSION;
+        memcpy(cold(cs)->wm_class, wm_class, sizeof(cold(cs)->wm_class));
+        fetch_title(cs);
+        icon_request(cs);
+        ipc_event("map 0x%lx\n", client);
+        set_client_desktop(cs);
+        grid_update(cs);
+        fetch_protocols(cs);
+        mark_monitor_dirty(mon);
+    }
+
+    if (!visible) {
+        if (attrs.map_state != IsUnmapped) {
+            XUnmapWindow(dpy, client);
+            if (cs) cold(cs)->ignore_unmap++;
+        }
+        set_wm_state(client, IconicState);
+        return;
+    }
+    XMapWindow(dpy, client);
+    set_wm_state(client, NormalState);
+    XMapWindow(dpy, frame);
 
-    add_client(client, frame, mon);
-    update_client_list();
+    if (monitors[mon].fullscreen) {
+        raise_bars();
+        return;
+    }
 
     XSetInputFocus(dpy, client, RevertToPointerRoot, CurrentTime);
     focus_window = client;
-    active_monitor = mon;
+    set_active_monitor(mon);
     set_active_window(client);
     update_all_bars();
 }
 
+void alt_tab_free_list(void) {
+    arena_reset(&alt_tab_arena);
+    alt_tab.names = alt_tab.hay = NULL;
+    alt_tab.frames = alt_tab.clients = NULL;
+    alt_tab.is_hidden = alt_tab.pos = alt_tab.vis = alt_tab.shown = NULL;
+    alt_tab.count = alt_tab.nvis = 0;
+}
+
 void alt_tab_cleanup(void) {
     if (alt_tab.keyboard_grabbed) {
         XUngrabKeyboard(dpy, CurrentTime);
@@ -834,88 +3916,218 @@ void alt_tab_cleanup(void) {
         XDestroyWindow(dpy, alt_tab.menu_win);
         alt_tab.menu_win = 0;
     }
-    if (alt_tab.names) {
-        for (int i = 0; i < alt_tab.count; i++) {
-            if (alt_tab.names[i]) {
-                free(alt_tab.names[i]);
-            }
+    alt_tab_free_list();
+    alt_tab.selected = 0;
+    alt_tab.active = 0;
+    XSync(dpy, False);
+}
+
+void alt_tab_draw_item(int k) {
+    int i = k < alt_tab.nvis ? alt_tab.vis[k] : -1;
+    unsigned long bg = i >= 0 && k == alt_tab.selected ? px.highlight : px.bar;
+    char label[300], display[128];
+
+    if (conf.preview) {
+        int row = k / alt_tab.cols - alt_tab.top;
+        if (row < 0 || row >= alt_tab.rows) return;
+        int x = ALT_TAB_PADDING + (k % alt_tab.cols) * ALT_TAB_CELL_W;
+        int y = ALT_TAB_PADDING + row * ALT_TAB_CELL_H;
+        XSetForeground(dpy, alt_tab.gc, bg);
+        XFillRectangle(dpy, alt_tab.menu_win, alt_tab.gc, x, y, ALT_TAB_CELL_W, ALT_TAB_CELL_H);
+    } else {
+        int y = ALT_TAB_PADDING + k * ALT_TAB_ITEM_H;
+        XSetForeground(dpy, alt_tab.gc, bg);
+        XFillRectangle(dpy, alt_tab.menu_win, alt_tab.gc,
+                       ALT_TAB_PADDING, y,
+                       ALT_TAB_WIDTH - ALT_TAB_PADDING * 2, ALT_TAB_ITEM_H - 4);
+    }
+    if (i < 0) return;
+
+    unsigned long fg = (alt_tab.is_hidden && alt_tab.is_hidden[i]) ? px.dim : px.text;
+    const char *name = (alt_tab.names && alt_tab.names[i]) ? alt_tab.names[i] : "(unnamed)";
+    ClientState *cs = alt_tab.clients ? get_client_state(alt_tab.clients[i]) : NULL;
+    Pixmap icon = cs ? icon_pixmap(cs, ICON_ALTTAB, bg) : None;
+    int size = icon_px[ICON_ALTTAB];
+
+    if (conf.preview) {
+        int x = ALT_TAB_PADDING + (k % alt_tab.cols) * ALT_TAB_CELL_W;
+        int y = ALT_TAB_PADDING + (k / alt_tab.cols - alt_tab.top) * ALT_TAB_CELL_H;
+        ClientCold *cc = cs ? cold(cs) : NULL;
+        if (cc && cc->thumb_pix) {
+            XCopyArea(dpy, cc->thumb_pix, alt_tab.menu_win, alt_tab.gc, 0, 0, cc->thumb_w, cc->thumb_h,
+                      x + ALT_TAB_PADDING + (THUMB_W - cc->thumb_w) / 2,
+                      y + ALT_TAB_PADDING + (THUMB_H - cc->thumb_h) / 2);
+        } else if (icon) {
+            XCopyArea(dpy, icon, alt_tab.menu_win, alt_tab.gc, 0, 0, size, size,
+                      x + (ALT_TAB_CELL_W - size) / 2, y + ALT_TAB_PADDING + (THUMB_H - size) / 2);
         }
-        free(alt_tab.names);
-        alt_tab.names = NULL;
+        int len = ellipsize(name, display, sizeof(display), THUMB_W);
+        draw_text(alt_tab.menu_win, alt_tab.gc, x + ALT_TAB_PADDING,
+                  y + ALT_TAB_PADDING * 2 + THUMB_H + font_ascent(), display, len, fg);
+        return;
     }
-    if (alt_tab.frames) {
-        free(alt_tab.frames);
-        alt_tab.frames = NULL;
+
+    int y = ALT_TAB_PADDING + k * ALT_TAB_ITEM_H;
+    int ty = y + (ALT_TAB_ITEM_H / 2) + (font_ascent() / 2) - 2;
+    if (alt_tab.is_hidden && alt_tab.is_hidden[i]) {
+        snprintf(label, sizeof(label), " %d.  [hidden] %s", k + 1, name);
+    } else {
+        snprintf(label, sizeof(label), " %d.  %s", k + 1, name);
     }
-    if (alt_tab.clients) {
-        free(alt_tab.clients);
-        alt_tab.clients = NULL;
+
+    int tx = 15;
+    if (icon) {
+        XCopyArea(dpy, icon, alt_tab.menu_win, alt_tab.gc, 0, 0, size, size,
+                  12, y + (ALT_TAB_ITEM_H - 4 - size) / 2);
+        tx = 12 + size + 4;
     }
-    if (alt_tab.is_hidden) {
-        free(alt_tab.is_hidden);
-        alt_tab.is_hidden = NULL;
+
+    int len = ellipsize(label, display, sizeof(display), ALT_TAB_WIDTH - 25 - tx);
+    draw_text(alt_tab.menu_win, alt_tab.gc, tx, ty, display, len, fg);
+}
+
+void alt_tab_draw_query(void) {
+    int y = alt_tab.height - ALT_TAB_PADDING - ALT_TAB_QUERY_H;
+    char label[80], display[80];
+
+    if (!alt_tab.menu_win || !alt_tab.gc) return;
+    XSetForeground(dpy, alt_tab.gc, px.bar);
+    XFillRectangle(dpy, alt_tab.menu_win, alt_tab.gc, ALT_TAB_PADDING, y,
+                   alt_tab.width - ALT_TAB_PADDING * 2, ALT_TAB_QUERY_H);
+    if (!alt_tab.qlen) return;
+    snprintf(label, sizeof(label), "> %s", alt_tab.query);
+    int len = ellipsize(label, display, sizeof(display), alt_tab.width - ALT_TAB_PADDING * 4);
+    draw_text(alt_tab.menu_win, alt_tab.gc, ALT_TAB_PADDING * 2,
+              y + (ALT_TAB_QUERY_H + font_ascent()) / 2, display, len,
+              alt_tab.nvis ? px.text : px.dim);
+}
+
+void alt_tab_sync(void) {
+    if (!alt_tab.active || !alt_tab.menu_win || !alt_tab.gc) return;
+
+    if (conf.preview) {
+        int row = alt_tab.selected / alt_tab.cols, top = alt_tab.top;
+        if (row < top) top = row;
+        if (row >= top + alt_tab.rows) top = row - alt_tab.rows + 1;
+        if (top != alt_tab.top) {
+            alt_tab.top = top;
+            for (int k = 0; k < alt_tab.count; k++) alt_tab.shown[k] = -2;
+        }
     }
-    alt_tab.count = 0;
-    alt_tab.selected = 0;
-    alt_tab.active = 0;
-    XSync(dpy, False);
+
+    for (int k = 0; k < alt_tab.count; k++) {
+        int i = k < alt_tab.nvis ? alt_tab.vis[k] : -1;
+        if (alt_tab.shown[k] != i || (k == alt_tab.selected) != (k == alt_tab.shown_sel)) {
+            alt_tab_draw_item(k);
+            alt_tab.shown[k] = i;
+        }
+    }
+    alt_tab.shown_sel = alt_tab.selected;
+    XFlush(dpy);
 }
 
 void alt_tab_draw(void) {
     if (!alt_tab.active || !alt_tab.menu_win || !alt_tab.gc) return;
 
-    unsigned long bg_px = get_pixel(conf.bar_color);
-    unsigned long hl_px = get_pixel(conf.highlight_color);
-    unsigned long txt_px = get_pixel(conf.text_color);
-    unsigned long bdr_px = get_pixel(conf.border_color);
-    unsigned long dim_px = get_pixel("#888888");
+    XSetForeground(dpy, alt_tab.gc, px.bar);
+    XFillRectangle(dpy, alt_tab.menu_win, alt_tab.gc, 0, 0, alt_tab.width, alt_tab.height);
+    XSetForeground(dpy, alt_tab.gc, px.border);
+    XDrawRectangle(dpy, alt_tab.menu_win, alt_tab.gc, 0, 0, alt_tab.width - 1, alt_tab.height - 1);
+    alt_tab_draw_query();
+
+    for (int k = 0; k < alt_tab.count; k++) alt_tab.shown[k] = -2;
+    alt_tab_sync();
+}
+
+void alt_tab_prev(void) {
+    if (!alt_tab.active || alt_tab.nvis < 1) return;
+    alt_tab.selected = (alt_tab.selected - 1 + alt_tab.nvis) % alt_tab.nvis;
+    alt_tab_sync();
+}
+
+void alt_tab_next(void) {
+    if (!alt_tab.active || alt_tab.nvis < 1) return;
+    alt_tab.selected = (alt_tab.selected + 1) % alt_tab.nvis;
+    alt_tab_sync();
+}
+
+int alt_tab_advance(int i, char c) {
+    const char *p = strchr(alt_tab.hay[i] + alt_tab.pos[i], c);
+    if (!p) return 0;
+    alt_tab.pos[i] = p - alt_tab.hay[i] + 1;
+    return 1;
+}
+
+void alt_tab_type(char c) {
+    if (!alt_tab.active || alt_tab.qlen >= (int)sizeof(alt_tab.query) - 1) return;
+    c = tolower((unsigned char)c);
+    alt_tab.query[alt_tab.qlen++] = c;
+    alt_tab.query[alt_tab.qlen] = '\0';
 
-    int menu_h = alt_tab.count * ALT_TAB_ITEM_H + ALT_TAB_PADDING * 2;
+    int n = 0;
+    for (int k = 0; k < alt_tab.nvis; k++) {
+        int i = alt_tab.vis[k];
+        if (alt_tab_advance(i, c)) alt_tab.vis[n++] = i;
+    }
+    alt_tab.nvis = n;
+    alt_tab.selected = 0;
+    alt_tab_draw_query();
+    alt_tab_sync();
+}
 
-    XSetForeground(dpy, alt_tab.gc, bg_px);
-    XFillRectangle(dpy, alt_tab.menu_win, alt_tab.gc, 0, 0, ALT_TAB_WIDTH, menu_h);
+void alt_tab_erase(void) {
+    if (!alt_tab.active || !alt_tab.qlen) return;
+    alt_tab.query[--alt_tab.qlen] = '\0';
 
+    alt_tab.nvis = 0;
     for (int i = 0; i < alt_tab.count; i++) {
-        int y = ALT_TAB_PADDING + i * ALT_TAB_ITEM_H;
-
-        if (i == alt_tab.selected) {
-            XSetForeground(dpy, alt_tab.gc, hl_px);
-            XFillRectangle(dpy, alt_tab.menu_win, alt_tab.gc, 
-                          ALT_TAB_PADDING, y, 
-                          ALT_TAB_WIDTH - ALT_TAB_PADDING * 2, ALT_TAB_ITEM_H - 4);
-        }
-
-        XSetForeground(dpy, alt_tab.gc, 
-                      (alt_tab.is_hidden && alt_tab.is_hidden[i]) ? dim_px : txt_px);
-        
-        int ty = y + (ALT_TAB_ITEM_H / 2) + (font_info->ascent / 2) - 2;
-
-        char display[128];
-        const char *name = (alt_tab.names && alt_tab.names[i]) ? 
-                           alt_tab.names[i] : "(unnamed)";
-        
-        if (alt_tab.is_hidden && alt_tab.is_hidden[i]) {
-            snprintf(display, sizeof(display), " %d.  [hidden] %s", i + 1, name);
-        } else {
-            snprintf(display, sizeof(display), " %d.  %s", i + 1, name);
-        }
+        int ok = 1;
+        alt_tab.pos[i] = 0;
+        for (const char *q = alt_tab.query; *q && ok; q++) ok = alt_tab_advance(i, *q);
+        if (ok) alt_tab.vis[alt_tab.nvis++] = i;
+    }
+    alt_tab.selected = alt_tab.qlen || alt_tab.nvis < 2 ? 0 : 1;
+    alt_tab_draw_query();
+    alt_tab_sync();
+}
 
-        int max_w = ALT_TAB_WIDTH - 40;
-        size_t len = strlen(display);
-        while (len > 3 && XTextWidth(font_info, display, len) > max_w) {
-            display[len - 4] = '.';
-            display[len - 3] = '.';
-            display[len - 2] = '.';
-            display[len - 1] = '\0';
-            len--;
+void icon_handle(void) {
+    uint64_t v;
+    int redraw_alt = 0;
+    IconJob *job;
+
+    if (read(icon_done_fd, &v, sizeof(v)) < 0 && errno != EAGAIN) return;
+    while ((job = icon_pop(&icon_results))) {
+        ClientState *cs = get_client_state(job->win);
+        if (cs && job->kind == JOB_THUMB) {
+            cold(cs)->thumb_busy = 0;
+            if (job->pixels[0]) thumb_store(cs, job->pixels[0], job->w, job->h);
+            redraw_alt = 1;
+        } else if (cs && cold(cs)->icon_busy) {
+            cold(cs)->icon_busy = 0;
+            for (int i = 0; i < ICON_SIZES; i++) {
+                free(cold(cs)->icon[i]);
+                cold(cs)->icon[i] = job->pixels[i];
+                cold(cs)->icon_valid[i] = 0;
+                job->pixels[i] = NULL;
+            }
+            redraw_decorations(cs);
+            if (cold(cs)->icon_stale) icon_request(cs);
+            redraw_alt = 1;
         }
-
-        XDrawString(dpy, alt_tab.menu_win, alt_tab.gc, 15, ty, display, strlen(display));
+        icon_job_free(job);
     }
+    if (redraw_alt && alt_tab.active) alt_tab_draw();
+}
 
-    XSetForeground(dpy, alt_tab.gc, bdr_px);
-    XDrawRectangle(dpy, alt_tab.menu_win, alt_tab.gc, 0, 0, ALT_TAB_WIDTH - 1, menu_h - 1);
-    XFlush(dpy);
+char *alt_tab_haystack(ClientState *cs) {
+    ClientCold *cc = cold(cs);
+    size_t size = strlen(cc->wm_class) + strlen(cc->title) + 2;
+    char *hay = arena_alloc(&alt_tab_arena, size);
+    if (!hay) return NULL;
+    int n = snprintf(hay, size, "%s %s", cc->wm_class, cc->title);
+    for (int i = 0; i < n; i++) hay[i] = tolower((unsigned char)hay[i]);
+    return hay;
 }
 
 int alt_tab_build_list(void) {
@@ -926,34 +4138,28 @@ int alt_tab_build_list(void) {
 
     if (count < 1) return 0;
 
-    alt_tab.frames = calloc(count, sizeof(Window));
-    alt_tab.clients = calloc(count, sizeof(Window));
-    alt_tab.names = calloc(count, sizeof(char *));
-    alt_tab.is_hidden = calloc(count, sizeof(int));
-    
-    if (!alt_tab.frames || !alt_tab.clients || !alt_tab.names || !alt_tab.is_hidden) {
-        free(alt_tab.frames);
-        free(alt_tab.clients);
-        free(alt_tab.names);
-        free(alt_tab.is_hidden);
-        alt_tab.frames = NULL;
-        alt_tab.clients = NULL;
-        alt_tab.names = NULL;
-        alt_tab.is_hidden = NULL;
+    Arena *a = &alt_tab_arena;
+    arena_reset(a);
+    alt_tab.frames = arena_calloc(a, count, sizeof(Window));
+    alt_tab.clients = arena_calloc(a, count, sizeof(Window));
+    alt_tab.names = arena_calloc(a, count, sizeof(char *));
+    alt_tab.is_hidden = arena_calloc(a, count, sizeof(int));
+    alt_tab.hay = arena_calloc(a, count, sizeof(char *));
+    alt_tab.pos = arena_calloc(a, count, sizeof(int));
+    alt_tab.vis = arena_calloc(a, count, sizeof(int));
+    alt_tab.shown = arena_calloc(a, count, sizeof(int));
+    alt_tab.count = count;
+
+    if (!alt_tab.frames || !alt_tab.clients || !alt_tab.names || !alt_tab.is_hidden ||
+        !alt_tab.hay || !alt_tab.pos || !alt_tab.vis || !alt_tab.shown) {
+        alt_tab_free_list();
         return 0;
     }
 
     Window root_ret, parent_ret, *children = NULL;
     unsigned int nchildren;
     if (!XQueryTree(dpy, root, &root_ret, &parent_ret, &children, &nchildren)) {
-        free(alt_tab.frames);
-        free(alt_tab.clients);
-        free(alt_tab.names);
-        free(alt_tab.is_hidden);
-        alt_tab.frames = NULL;
-        alt_tab.clients = NULL;
-        alt_tab.names = NULL;
-        alt_tab.is_hidden = NULL;
+        alt_tab_free_list();
         return 0;
     }
 
@@ -965,16 +4171,14 @@ int alt_tab_build_list(void) {
 
         for (int j = 0; j < client_count; j++) {
             if (clients[j].frame == frame) {
-                XWindowAttributes attr;
-                if (XGetWindowAttributes(dpy, frame, &attr) && attr.map_state == IsViewable) {
+                if (!clients[j].is_hidden && on_current_workspace(&clients[j])) {
                     alt_tab.frames[idx] = frame;
                     alt_tab.clients[idx] = clients[j].client;
                     alt_tab.is_hidden[idx] = 0;
                     
-                    char *name = NULL;
-                    XFetchName(dpy, clients[j].client, &name);
-                    alt_tab.names[idx] = name ? strdup(name) : strdup("(unnamed)");
-                    if (name) XFree(name);
+                    const char *title = cold(&clients[j])->title;
+                    alt_tab.names[idx] = arena_strdup(a, title[0] ? title : "(unnamed)");
+                    alt_tab.hay[idx] = alt_tab_haystack(&clients[j]);
                     idx++;
                 }
                 break;
@@ -988,16 +4192,14 @@ int alt_tab_build_list(void) {
 
         for (int j = 0; j < client_count; j++) {
             if (clients[j].frame == frame) {
-                XWindowAttributes attr;
-                if (XGetWindowAttributes(dpy, frame, &attr) && attr.map_state == IsUnmapped) {
+                if (clients[j].is_hidden && on_current_workspace(&clients[j])) {
                     alt_tab.frames[idx] = frame;
                     alt_tab.clients[idx] = clients[j].client;
                     alt_tab.is_hidden[idx] = 1;
                     
-                    char *name = NULL;
-                    XFetchName(dpy, clients[j].client, &name);
-                    alt_tab.names[idx] = name ? strdup(name) : strdup("(unnamed)");
-                    if (name) XFree(name);
+                    const char *title = cold(&clients[j])->title;
+                    alt_tab.names[idx] = arena_strdup(a, title[0] ? title : "(unnamed)");
+                    alt_tab.hay[idx] = alt_tab_haystack(&clients[j]);
                     idx++;
                 }
                 break;
@@ -1007,14 +4209,23 @@ int alt_tab_build_list(void) {
 
     if (children) XFree(children);
     alt_tab.count = idx;
+    for (int i = 0; i < idx; i++) {
+        if (!alt_tab.names[i] || !alt_tab.hay[i]) {
+            alt_tab_free_list();
+            return 0;
+        }
+        alt_tab.vis[i] = i;
+    }
+    alt_tab.nvis = idx;
+    alt_tab.query[0] = '\0';
+    alt_tab.qlen = 0;
     alt_tab.selected = (idx > 1) ? 1 : 0;
     return idx;
 }
 
 void alt_tab_show(void) {
     if (alt_tab.active) {
-        alt_tab.selected = (alt_tab.selected + 1) % alt_tab.count;
-        alt_tab_draw();
+        alt_tab_next();
         return;
     }
 
@@ -1022,44 +4233,38 @@ void alt_tab_show(void) {
     if (n < 1) return;
 
     if (n == 1) {
-        if (alt_tab.is_hidden && alt_tab.is_hidden[0]) {
-            XMapWindow(dpy, alt_tab.frames[0]);
-        }
-        XRaiseWindow(dpy, alt_tab.frames[0]);
-        raise_bars();
-        XSetInputFocus(dpy, alt_tab.clients[0], RevertToPointerRoot, CurrentTime);
-        focus_window = alt_tab.clients[0];
-        
-        ClientState *cs = get_client_state(focus_window);
-        if (cs) active_monitor = cs->monitor;
-        
-        set_active_window(focus_window);
+        activate_client(get_client_state(alt_tab.clients[0]));
         update_all_bars();
-        
-        if (alt_tab.names && alt_tab.names[0]) free(alt_tab.names[0]);
-        free(alt_tab.frames);
-        free(alt_tab.clients);
-        free(alt_tab.names);
-        free(alt_tab.is_hidden);
-        alt_tab.frames = NULL;
-        alt_tab.clients = NULL;
-        alt_tab.names = NULL;
-        alt_tab.is_hidden = NULL;
-        alt_tab.count = 0;
+        alt_tab_free_list();
         return;
     }
 
     int mon = active_monitor;
     if (mon < 0 || mon >= monitor_count) mon = 0;
     
-    int menu_h = alt_tab.count * ALT_TAB_ITEM_H + ALT_TAB_PADDING * 2;
-    int menu_x = monitors[mon].x + (monitors[mon].w - ALT_TAB_WIDTH) / 2;
-    int menu_y = monitors[mon].y + (monitors[mon].h - menu_h) / 2;
+    if (conf.preview) {
+        alt_tab.cols = (monitors[mon].w * 4 / 5 - ALT_TAB_PADDING * 2) / ALT_TAB_CELL_W;
+        if (alt_tab.cols < 1) alt_tab.cols = 1;
+        if (alt_tab.cols > n) alt_tab.cols = n;
+        alt_tab.rows = (monitors[mon].h * 4 / 5 - ALT_TAB_PADDING * 2) / ALT_TAB_CELL_H;
+        if (alt_tab.rows < 1) alt_tab.rows = 1;
+        if (alt_tab.rows > (n + alt_tab.cols - 1) / alt_tab.cols) {
+            alt_tab.rows = (n + alt_tab.cols - 1) / alt_tab.cols;
+        }
+        alt_tab.top = 0;
+        alt_tab.width = alt_tab.cols * ALT_TAB_CELL_W + ALT_TAB_PADDING * 2;
+        alt_tab.height = alt_tab.rows * ALT_TAB_CELL_H + ALT_TAB_PADDING * 2 + ALT_TAB_QUERY_H;
+    } else {
+        alt_tab.width = ALT_TAB_WIDTH;
+        alt_tab.height = alt_tab.count * ALT_TAB_ITEM_H + ALT_TAB_PADDING * 2 + ALT_TAB_QUERY_H;
+    }
+    int menu_x = monitors[mon].x + (monitors[mon].w - alt_tab.width) / 2;
+    int menu_y = monitors[mon].y + (monitors[mon].h - alt_tab.height) / 2;
 
     alt_tab.menu_win = XCreateSimpleWindow(dpy, root, menu_x, menu_y,
-                                           ALT_TAB_WIDTH, menu_h, 2,
-                                           get_pixel(conf.border_color),
-                                           get_pixel(conf.bar_color));
+                                           alt_tab.width, alt_tab.height, 2,
+                                           px.border,
+                                           px.bar);
 
     XSetWindowAttributes swa;
     swa.override_redirect = True;
@@ -1087,18 +4292,7 @@ void alt_tab_show(void) {
         XFreeGC(dpy, alt_tab.gc);
         alt_tab.menu_win = 0;
         alt_tab.gc = NULL;
-        for (int i = 0; i < alt_tab.count; i++) {
-            if (alt_tab.names && alt_tab.names[i]) free(alt_tab.names[i]);
-        }
-        free(alt_tab.frames);
-        free(alt_tab.clients);
-        free(alt_tab.names);
-        free(alt_tab.is_hidden);
-        alt_tab.frames = NULL;
-        alt_tab.clients = NULL;
-        alt_tab.names = NULL;
-        alt_tab.is_hidden = NULL;
-        alt_tab.count = 0;
+        alt_tab_free_list();
         return;
     }
 
@@ -1109,29 +4303,14 @@ void alt_tab_show(void) {
 void alt_tab_confirm(void) {
     if (!alt_tab.active) return;
 
-    Window frame = 0, client = 0;
-    int was_hidden = 0;
+    Window client = 0;
     
-    if (alt_tab.selected >= 0 && alt_tab.selected < alt_tab.count) {
-        frame = alt_tab.frames[alt_tab.selected];
-        client = alt_tab.clients[alt_tab.selected];
-        was_hidden = alt_tab.is_hidden ? alt_tab.is_hidden[alt_tab.selected] : 0;
+    if (alt_tab.selected >= 0 && alt_tab.selected < alt_tab.nvis) {
+        client = alt_tab.clients[alt_tab.vis[alt_tab.selected]];
     }
 
     alt_tab_cleanup();
-    
-    if (frame && client) {
-        if (was_hidden) XMapWindow(dpy, frame);
-        XRaiseWindow(dpy, frame);
-        raise_bars();
-        XSetInputFocus(dpy, client, RevertToPointerRoot, CurrentTime);
-        focus_window = client;
-        
-        ClientState *cs = get_client_state(client);
-        if (cs) active_monitor = cs->monitor;
-        
-        set_active_window(client);
-    }
+    activate_client(get_client_state(client));
     
     update_all_bars();
 }
@@ -1141,18 +4320,6 @@ void alt_tab_cancel(void) {
     alt_tab_cleanup();
 }
 
-void alt_tab_prev(void) {
-    if (!alt_tab.active || alt_tab.count < 1) return;
-    alt_tab.selected = (alt_tab.selected - 1 + alt_tab.count) % alt_tab.count;
-    alt_tab_draw();
-}
-
-void alt_tab_next(void) {
-    if (!alt_tab.active || alt_tab.count < 1) return;
-    alt_tab.selected = (alt_tab.selected + 1) % alt_tab.count;
-    alt_tab_draw();
-}
-
 int is_alt_pressed(void) {
     char keys[32];
     XQueryKeymap(dpy, keys);
@@ -1171,20 +4338,19 @@ int is_alt_pressed(void) {
 }
 
 void show_hidden_menu(void) {
-    typedef struct { Window frame; char *name; } HiddenWin;
+    typedef struct { Window frame; const char *name; } HiddenWin;
     HiddenWin hidden[64];
     int count = 0;
 
+    arena_reset(&menu_arena);
     for (int i = 0; i < client_count && count < 64; i++) {
-        if (clients[i].frame) {
-            XWindowAttributes attr;
-            if (XGetWindowAttributes(dpy, clients[i].frame, &attr) && 
-                attr.map_state == IsUnmapped) {
-                char *name = NULL;
-                XFetchName(dpy, clients[i].client, &name);
+        if (clients[i].frame && on_current_workspace(&clients[i])) {
+            if (clients[i].is_hidden) {
+                const char *title = cold(&clients[i])->title;
+                if (!title[0]) title = "(unnamed)";
                 hidden[count].frame = clients[i].frame;
-                hidden[count].name = name ? strdup(name) : strdup("(unnamed)");
-                if (name) XFree(name);
+                hidden[count].name = arena_strdup(&menu_arena, title);
+                if (!hidden[count].name) hidden[count].name = "(unnamed)";
                 count++;
             }
         }
@@ -1200,167 +4366,689 @@ void show_hidden_menu(void) {
     int menu_x = monitors[mon].x + (monitors[mon].w - menu_w) / 2;
     int menu_y = monitors[mon].y + (monitors[mon].h - menu_h) / 2;
 
-    Window menu = XCreateSimpleWindow(dpy, root, menu_x, menu_y, menu_w, menu_h, 2,
-                                      get_pixel(conf.border_color), 
-                                      get_pixel(conf.bar_color));
+    Window menu = XCreateSimpleWindow(dpy, root, menu_x, menu_y, menu_w, menu_h, 2,
+                                      px.border, 
+                                      px.bar);
+
+    XSetWindowAttributes swa;
+    swa.override_redirect = True;
+    XChangeWindowAttributes(dpy, menu, CWOverrideRedirect, &swa);
+
+    XSelectInput(dpy, menu, ExposureMask | PointerMotionMask | 
+                 ButtonPressMask | KeyPressMask);
+    XMapRaised(dpy, menu);
+    XGrabPointer(dpy, menu, True, ButtonPressMask | PointerMotionMask,
+                 GrabModeAsync, GrabModeAsync, None, None, CurrentTime);
+    XGrabKeyboard(dpy, menu, True, GrabModeAsync, GrabModeAsync, CurrentTime);
+
+    GC gc = XCreateGC(dpy, menu, 0, NULL);
+    XSetFont(dpy, gc, font_info->fid);
+
+    int selected = 0;
+    int done = 0;
+    XEvent ev;
+
+    while (!done) {
+        XNextEvent(dpy, &ev);
+
+        if (ev.type == Expose) {
+            for (int i = 0; i < count; i++) {
+                int y = i * MENU_ITEM_H;
+                XSetForeground(dpy, gc, (i == selected) ? 
+                              px.highlight : 
+                              px.bar);
+                XFillRectangle(dpy, menu, gc, 0, y, menu_w, MENU_ITEM_H);
+                int ty = y + MENU_ITEM_H / 2 + font_ascent() / 2 - 1;
+                draw_text(menu, gc, 10, ty, hidden[i].name, strlen(hidden[i].name), px.text);
+                XSetForeground(dpy, gc, px.border);
+                XDrawLine(dpy, menu, gc, 0, y + MENU_ITEM_H - 1, 
+                         menu_w, y + MENU_ITEM_H - 1);
+            }
+        } 
+        else if (ev.type == MotionNotify) {
+            int item = ev.xmotion.y / MENU_ITEM_H;
+            if (item >= 0 && item < count && item != selected) {
+                selected = item;
+                XClearArea(dpy, menu, 0, 0, 0, 0, True);
+            }
+        } 
+        else if (ev.type == ButtonPress || 
+                 (ev.type == KeyPress && XLookupKeysym(&ev.xkey, 0) == XK_Return)) {
+            activate_client(get_client_state_by_frame(hidden[selected].frame));
+            done = 1;
+        } 
+        else if (ev.type == KeyPress) {
+            KeySym ks = XLookupKeysym(&ev.xkey, 0);
+            if (ks == XK_Escape) {
+                done = 1;
+            } else if (ks == XK_Up || ks == XK_k) {
+                selected = (selected - 1 + count) % count;
+                XClearArea(dpy, menu, 0, 0, 0, 0, True);
+            } else if (ks == XK_Down || ks == XK_j) {
+                selected = (selected + 1) % count;
+                XClearArea(dpy, menu, 0, 0, 0, 0, True);
+            }
+        }
+    }
+
+    XUngrabPointer(dpy, CurrentTime);
+    XUngrabKeyboard(dpy, CurrentTime);
+    XDestroyWindow(dpy, menu);
+    XFreeGC(dpy, gc);
+
+    arena_reset(&menu_arena);
+    update_all_bars();
+}
+
+void unhide_all(void) {
+    for (int i = 0; i < client_count; i++) {
+        if (on_current_workspace(&clients[i])) show_client(&clients[i]);
+    }
+    raise_bars();
+    update_all_bars();
+}
+
+int x_error_handler(Display *d, XErrorEvent *e) {
+    if (d != dpy) return 0;
+    if (trap_errors && e->error_code == BadWindow && trapped_count < MAX_CLIENTS) {
+        trapped_errors[trapped_count++] = e->resourceid;
+    }
+    return 0;
+}
+
+void run_action(int action, int arg, const char *cmd) {
+    switch (action) {
+        case ACT_QUIT:
+            running = 0;
+            break;
+        case ACT_RESTART:
+            restarting = 1;
+            running = 0;
+            break;
+        case ACT_ALTTAB:
+            alt_tab_show();
+            break;
+        case ACT_MENU:
+            show_hidden_menu();
+            break;
+        case ACT_UNHIDE:
+            unhide_all();
+            break;
+        case ACT_CLOSE:
+            if (focus_window) close_client(focus_window);
+            break;
+        case ACT_FULLSCREEN:
+            if (focus_window) toggle_fullscreen(focus_window);
+            break;
+        case ACT_SNAP_LEFT:
+            if (focus_window) snap_window(focus_window, 0);
+            break;
+        case ACT_SNAP_RIGHT:
+            if (focus_window) snap_window(focus_window, 1);
+            break;
+        case ACT_MAXIMIZE:
+            if (focus_window) snap_window(focus_window, 2);
+            break;
+        case ACT_RESTORE:
+            if (focus_window) snap_window(focus_window, 3);
+            break;
+        case ACT_WORKSPACE:
+            switch_workspace(active_monitor, arg - 1);
+            break;
+        case ACT_MOVE_TO:
+            move_to_workspace(get_client_state(focus_window), arg - 1);
+            break;
+        case ACT_TILE:
+            set_layout(active_monitor, LAYOUT_TILE);
+            break;
+        case ACT_GRID:
+            set_layout(active_monitor, LAYOUT_GRID);
+            break;
+        case ACT_FLOAT:
+            set_layout(active_monitor, LAYOUT_FLOAT);
+            break;
+        default:
+            spawn(cmd);
+            break;
+    }
+}
+
+void execute_keybind(KeySym key, unsigned int state) {
+    unsigned int clean_state = CLEANMASK(state);
+    
+    for (int i = 0; i < bind_count; i++) {
+        if (binds[i].key == key && binds[i].mod == clean_state) {
+            run_action(binds[i].action, binds[i].arg, binds[i].command);
+            return;
+        }
+    }
+}
+
+void ipc_open(void) {
+    struct sockaddr_un addr;
+    const char *dir = getenv("XDG_RUNTIME_DIR");
+    int n = dir ? snprintf(ipc_path, sizeof(ipc_path), "%s/lwm.sock", dir)
+                : snprintf(ipc_path, sizeof(ipc_path), "/tmp/lwm-%d.sock", (int)getuid());
+    if (n < 0 || (size_t)n >= sizeof(ipc_path) || (size_t)n >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long, IPC disabled\n");
+        ipc_path[0] = '\0';
+        return;
+    }
+
+    ipc_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (ipc_fd < 0) return;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, ipc_path, n + 1);
+    unlink(ipc_path);
+
+    mode_t old = umask(077);
+    int ok = bind(ipc_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0 && listen(ipc_fd, 8) == 0;
+    umask(old);
+    if (!ok) {
+        close(ipc_fd);
+        ipc_fd = -1;
+        return;
+    }
+    setenv("LWM_SOCKET", ipc_path, 1);
+}
+
+void ipc_close(void) {
+    while (ipc_count > 0) ipc_drop(ipc_count - 1);
+    if (ipc_fd >= 0) {
+        close(ipc_fd);
+        unlink(ipc_path);
+        ipc_fd = -1;
+    }
+}
+
+void ipc_accept(void) {
+    int fd;
+    while ((fd = accept4(ipc_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        if (ipc_count >= IPC_MAX_CONNS) {
+            close(fd);
+            continue;
+        }
+        IpcConn *c = &ipc_conns[ipc_count++];
+        memset(c, 0, sizeof(*c));
+        c->fd = fd;
+    }
+}
+
+int ipc_command(IpcConn *c, char *line) {
+    long id;
+    int arg;
+
+    if (strcmp(line, "subscribe") == 0) {
+        c->subscribed = 1;
+    } else if (sscanf(line, "focus %li", &id) == 1) {
+        ClientState *cs = get_client_state((Window)id);
+        if (!cs || !cs->frame) return ipc_send(c, "error no such window\n", 21);
+        activate_client(cs);
+        update_all_bars();
+    } else if (strncmp(line, "exec ", 5) == 0) {
+        spawn(line + 5);
+    } else if (strcmp(line, "stats") == 0) {
+        char msg[160];
+        int len = snprintf(msg, sizeof(msg), "thumbs %d bytes %ld budget %ld shm %ld\n", thumb_count,
+                           thumb_bytes, (long)conf.preview_memory * 1024,
+                           __atomic_load_n(&thumb_shm_bytes, __ATOMIC_RELAXED));
+        if (!ipc_send(c, msg, len)) return 0;
+    } else {
+        int action = parse_action(line, &arg);
+        if (action == ACT_SPAWN) return ipc_send(c, "error unknown command\n", 22);
+        if (action == ACT_MENU) return ipc_send(c, "error menu is interactive\n", 26);
+        run_action(action, arg, NULL);
+    }
+    return ipc_send(c, "ok\n", 3);
+}
+
+int ipc_read(IpcConn *c) {
+    ssize_t n = read(c->fd, c->in + c->in_len, IPC_IN_SIZE - c->in_len);
+    if (n == 0) return 0;
+    if (n < 0) return errno == EAGAIN || errno == EINTR;
+    c->in_len += n;
+
+    char *start = c->in;
+    char *nl;
+    while ((nl = memchr(start, '\n', c->in + c->in_len - start))) {
+        *nl = '\0';
+        if (nl > start && nl[-1] == '\r') nl[-1] = '\0';
+        if (*start && !ipc_command(c, start)) return 0;
+        start = nl + 1;
+    }
+    c->in_len -= start - c->in;
+    memmove(c->in, start, c->in_len);
+    return c->in_len < IPC_IN_SIZE;
+}
+
+int ipc_write(IpcConn *c) {
+    if (c->dead) return 0;
+    if (c->out_len == 0) return 1;
+    ssize_t n = send(c->fd, c->out, c->out_len, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n < 0) return errno == EAGAIN || errno == EINTR;
+    c->out_len -= n;
+    memmove(c->out, c->out + n, c->out_len);
+    return 1;
+}
+
+void ipc_fill_fds(fd_set *rfds, fd_set *wfds, int *max_fd) {
+    if (ipc_fd < 0) return;
+    FD_SET(ipc_fd, rfds);
+    if (ipc_fd > *max_fd) *max_fd = ipc_fd;
+    for (int i = 0; i < ipc_count; i++) {
+        int fd = ipc_conns[i].fd;
+        FD_SET(fd, rfds);
+        if (ipc_conns[i].out_len) FD_SET(fd, wfds);
+        if (fd > *max_fd) *max_fd = fd;
+    }
+}
+
+void ipc_handle(fd_set *rfds, fd_set *wfds) {
+    if (ipc_fd < 0) return;
+    if (FD_ISSET(ipc_fd, rfds)) ipc_accept();
+    for (int i = ipc_count - 1; i >= 0; i--) {
+        IpcConn *c = &ipc_conns[i];
+        if (!FD_ISSET(c->fd, rfds) && !FD_ISSET(c->fd, wfds)) continue;
+        if ((FD_ISSET(c->fd, rfds) && !ipc_read(c)) || !ipc_write(c)) ipc_drop(i);
+    }
+}
+
+void ipc_flush(void) {
+    for (int i = ipc_count - 1; i >= 0; i--) {
+        if (!ipc_write(&ipc_conns[i])) ipc_drop(i);
+    }
+}
+
+void grab_bind(const KeyBind *kb, int grab) {
+    KeyCode kc = XKeysymToKeycode(dpy, kb->key);
+    if (!kc) return;
+
+    unsigned int modifiers[] = {
+        kb->mod,
+        kb->mod | Mod2Mask,
+        kb->mod | LockMask,
+        kb->mod | Mod2Mask | LockMask,
+    };
+
+    for (int m = 0; m < 4; m++) {
+        if (grab) {
+            XGrabKey(dpy, kc, modifiers[m], root, True,
+                     GrabModeAsync, GrabModeAsync);
+        } else {
+            XUngrabKey(dpy, kc, modifiers[m], root);
+        }
+    }
+}
+
+void grab_keys(void) {
+    XUngrabKey(dpy, AnyKey, AnyModifier, root);
+    
+    for (int i = 0; i < bind_count; i++) {
+        grab_bind(&binds[i], 1);
+    }
+    
+    XSync(dpy, False);
+}
+
+void grab_root_buttons(int grab) {
+    unsigned int mods[] = { 
+        mouse_mod_mask, 
+        mouse_mod_mask | Mod2Mask,
+        mouse_mod_mask | LockMask, 
+        mouse_mod_mask | Mod2Mask | LockMask 
+    };
+    for (int m = 0; m < 4; m++) {
+        if (grab) {
+            XGrabButton(dpy, Button1, mods[m], root, True, ButtonPressMask,
+                        GrabModeAsync, GrabModeAsync, None, None);
+            XGrabButton(dpy, Button3, mods[m], root, True, ButtonPressMask,
+                        GrabModeAsync, GrabModeAsync, None, None);
+        } else {
+            XUngrabButton(dpy, Button1, mods[m], root);
+            XUngrabButton(dpy, Button3, mods[m], root);
+        }
+    }
+}
+
+int load_font(const char *name) {
+#ifdef HAVE_XFT
+    int was_xft = xft_font != NULL;
+    if (strncmp(name, "xft:", 4) == 0) {
+        XftFont *xf = XftDefaultHasRender(dpy) ?
+                      XftFontOpenName(dpy, DefaultScreen(dpy), name + 4) : NULL;
+        if (xf) {
+            if (xft_font) XftFontClose(dpy, xft_font);
+            xft_font = xf;
+            memset(xft_adv, 0xff, sizeof(xft_adv));
+        }
+        name = "fixed";
+    } else if (xft_font) {
+        XftFontClose(dpy, xft_font);
+        xft_font = NULL;
+    }
+#endif
+    XFontStruct *f = XLoadQueryFont(dpy, name);
+    if (!f) f = XLoadQueryFont(dpy, "fixed");
+    if (!f) return 0;
+    if (font_info) XFreeFont(dpy, font_info);
+    font_info = f;
+    font_metrics();
+    for (int i = 0; i < client_count; i++) {
+        cold(&clients[i])->title_fit_w = -1;
+#ifdef HAVE_XFT
+        if (was_xft != (xft_font != NULL) && clients[i].frame) fetch_title(&clients[i]);
+#endif
+    }
+    return 1;
+}
 
-    XSetWindowAttributes swa;
-    swa.override_redirect = True;
-    XChangeWindowAttributes(dpy, menu, CWOverrideRedirect, &swa);
+void fit_client_to_monitor(ClientState *cs, int mon) {
+    Monitor *m = &monitors[mon];
 
-    XSelectInput(dpy, menu, ExposureMask | PointerMotionMask | 
-                 ButtonPressMask | KeyPressMask);
-    XMapRaised(dpy, menu);
-    XGrabPointer(dpy, menu, True, ButtonPressMask | PointerMotionMask,
-                 GrabModeAsync, GrabModeAsync, None, None, CurrentTime);
-    XGrabKeyboard(dpy, menu, True, GrabModeAsync, GrabModeAsync, CurrentTime);
+    if (cs->is_fullscreen) {
+        configure_client(cs, m->x, m->y, m->w, m->h);
+        return;
+    }
 
-    GC gc = XCreateGC(dpy, menu, 0, NULL);
-    XSetFont(dpy, gc, font_info->fid);
+    int x = cs->x, y = cs->y, w = cs->w, h = cs->h;
+    if (w > m->w) w = m->w;
+    if (h > m->h - BAR_HEIGHT) h = m->h - BAR_HEIGHT;
+    if (x < m->x || x + w > m->x + m->w) x = m->x + (m->w - w) / 2;
+    if (y < m->y + BAR_HEIGHT || y + h > m->y + m->h) y = m->y + BAR_HEIGHT + (m->h - BAR_HEIGHT - h) / 2;
 
-    int selected = 0;
-    int done = 0;
-    XEvent ev;
+    if (x != cs->x || y != cs->y || w != cs->w || h != cs->h) {
+        configure_client(cs, x, y, w, h);
+    }
+    cs->monitor = mon;
+}
 
-    while (!done) {
-        XNextEvent(dpy, &ev);
+void update_monitors(void) {
+    Monitor *mons = NULL;
+    int count = query_monitors(&mons);
+    if (count == 0) return;
+    snapshot_dirty = 1;
+
+    size_t mark = batch_arena.used;
+    int *remap = arena_alloc(&batch_arena, sizeof(int) * monitor_count);
+    int *resized = arena_calloc(&batch_arena, count, sizeof(int));
+    if (!remap || !resized) {
+        batch_arena.used = mark;
+        free(mons);
+        return;
+    }
 
-        if (ev.type == Expose) {
-            for (int i = 0; i < count; i++) {
-                int y = i * MENU_ITEM_H;
-                XSetForeground(dpy, gc, (i == selected) ? 
-                              get_pixel(conf.highlight_color) : 
-                              get_pixel(conf.bar_color));
-                XFillRectangle(dpy, menu, gc, 0, y, menu_w, MENU_ITEM_H);
-                XSetForeground(dpy, gc, get_pixel(conf.text_color));
-                int ty = y + MENU_ITEM_H / 2 + font_info->ascent / 2 - 1;
-                XDrawString(dpy, menu, gc, 10, ty, 
-                           hidden[i].name, strlen(hidden[i].name));
-                XSetForeground(dpy, gc, get_pixel(conf.border_color));
-                XDrawLine(dpy, menu, gc, 0, y + MENU_ITEM_H - 1, 
-                         menu_w, y + MENU_ITEM_H - 1);
-            }
-        } 
-        else if (ev.type == MotionNotify) {
-            int item = ev.xmotion.y / MENU_ITEM_H;
-            if (item >= 0 && item < count && item != selected) {
-                selected = item;
-                XClearArea(dpy, menu, 0, 0, 0, 0, True);
-            }
-        } 
-        else if (ev.type == ButtonPress || 
-                 (ev.type == KeyPress && XLookupKeysym(&ev.xkey, 0) == XK_Return)) {
-            XMapWindow(dpy, hidden[selected].frame);
-            XRaiseWindow(dpy, hidden[selected].frame);
-            raise_bars();
-            Window c = find_client_in_frame(hidden[selected].frame);
-            if (c) {
-                XSetInputFocus(dpy, c, RevertToPointerRoot, CurrentTime);
-                focus_window = c;
-                ClientState *cs = get_client_state(c);
-                if (cs) active_monitor = cs->monitor;
-                set_active_window(c);
+    for (int i = 0; i < monitor_count; i++) remap[i] = -1;
+
+    for (int i = 0; i < count; i++) {
+        for (int j = 0; j < monitor_count; j++) {
+            if (remap[j] < 0 && monitors[j].x == mons[i].x && monitors[j].y == mons[i].y &&
+                monitors[j].w == mons[i].w && monitors[j].h == mons[i].h) {
+                remap[j] = i;
+                mons[i].bar_win = monitors[j].bar_win;
+                mons[i].workspace = monitors[j].workspace;
+                mons[i].layout = monitors[j].layout;
+                mons[i].fullscreen = monitors[j].fullscreen;
+                break;
             }
-            done = 1;
-        } 
-        else if (ev.type == KeyPress) {
-            KeySym ks = XLookupKeysym(&ev.xkey, 0);
-            if (ks == XK_Escape) {
-                done = 1;
-            } else if (ks == XK_Up || ks == XK_k) {
-                selected = (selected - 1 + count) % count;
-                XClearArea(dpy, menu, 0, 0, 0, 0, True);
-            } else if (ks == XK_Down || ks == XK_j) {
-                selected = (selected + 1) % count;
-                XClearArea(dpy, menu, 0, 0, 0, 0, True);
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (mons[i].bar_win) continue;
+        for (int j = 0; j < monitor_count; j++) {
+            if (remap[j] < 0 && monitors[j].x == mons[i].x && monitors[j].y == mons[i].y) {
+                remap[j] = i;
+                resized[i] = 1;
+                mons[i].bar_win = monitors[j].bar_win;
+                mons[i].workspace = monitors[j].workspace;
+                mons[i].layout = monitors[j].layout;
+                mons[i].fullscreen = monitors[j].fullscreen;
+                if (mons[i].bar_win) {
+                    XMoveResizeWindow(dpy, mons[i].bar_win, mons[i].x, mons[i].y,
+                                      mons[i].w, BAR_HEIGHT);
+                }
+                break;
             }
         }
     }
 
-    XUngrabPointer(dpy, CurrentTime);
-    XUngrabKeyboard(dpy, CurrentTime);
-    XDestroyWindow(dpy, menu);
-    XFreeGC(dpy, gc);
+    for (int j = 0; j < monitor_count; j++) {
+        if (remap[j] < 0 && monitors[j].bar_win) XDestroyWindow(dpy, monitors[j].bar_win);
+    }
 
     for (int i = 0; i < count; i++) {
-        if (hidden[i].name) free(hidden[i].name);
+        if (!mons[i].bar_win) create_bar(&mons[i]);
     }
 
-    update_all_bars();
-}
+    int old_count = monitor_count;
+    Monitor *old = monitors;
+    monitors = mons;
+    monitor_count = count;
+
+    grid_init();
+    for (int i = 0; i < client_count; i++) {
+        cold(&clients[i])->indexed = 0;
+    }
 
-void unhide_all(void) {
     for (int i = 0; i < client_count; i++) {
-        if (clients[i].frame) {
-            XMapWindow(dpy, clients[i].frame);
+        ClientState *cs = &clients[i];
+        int old_mon = (cs->monitor >= 0 && cs->monitor < old_count) ? cs->monitor : 0;
+        int mon = remap[old_mon];
+
+        if (mon >= 0 && !resized[mon]) {
+            cs->monitor = mon;
+            continue;
+        }
+        if (mon < 0) {
+            mon = get_monitor_at(cs->x + cs->w / 2, cs->y + cs->h / 2);
+            cs->workspace = monitors[mon].workspace;
+            cs->due |= DUE_SESSION;
+            set_client_desktop(cs);
         }
+        if (cs->frame) fit_client_to_monitor(cs, mon);
+        else cs->monitor = mon;
+    }
+
+    if (active_monitor >= 0 && active_monitor < old_count && remap[active_monitor] >= 0) {
+        active_monitor = remap[active_monitor];
+    } else {
+        active_monitor = 0;
+    }
+
+    free(old);
+    batch_arena.used = mark;
+
+    for (int i = 0; i < client_count; i++) {
+        sync_visibility(&clients[i]);
+        grid_update(&clients[i]);
     }
+    for (int i = 0; i < monitor_count; i++) mark_monitor_dirty(i);
+
     raise_bars();
+    update_desktop_hints();
     update_all_bars();
 }
 
-int x_error_handler(Display *d, XErrorEvent *e) {
-    (void)d;
-    (void)e;
+int bind_in_set(const KeyBind *kb, const KeyBind *set, int count) {
+    for (int i = 0; i < count; i++) {
+        if (set[i].key == kb->key && set[i].mod == kb->mod) return 1;
+    }
     return 0;
 }
 
-void execute_keybind(KeySym key, unsigned int state) {
-    unsigned int clean_state = CLEANMASK(state);
-    
+void redraw_all_frames(void) {
+    for (int i = 0; i < client_count; i++) {
+        if (!clients[i].frame) continue;
+        XClearArea(dpy, clients[i].frame, 0, 0, 0, 0, True);
+    }
+}
+
+void reload_config(void) {
+    char path[256];
+    config_path(path, sizeof(path));
+    if (!path[0]) return;
+
+    struct Config nc;
+    KeyBind nb[MAX_BINDS];
+    int nb_count = 0;
+    static RuleSet nrs;
+    config_defaults(&nc);
+    if (!parse_config(path, &nc, nb, &nb_count, &nrs)) return;
+
+    int redraw_bars = 0;
+    int redraw_frames = 0;
+
+#define COLOR_CHANGED(field) (strcmp(conf.field, nc.field) != 0)
+    if (COLOR_CHANGED(bar_color)) {
+        px.bar = get_pixel(nc.bar_color);
+        for (int i = 0; i < monitor_count; i++) {
+            if (monitors[i].bar_win) XSetWindowBackground(dpy, monitors[i].bar_win, px.bar);
+        }
+        for (int i = 0; i < client_count; i++) {
+            if (clients[i].frame) XSetWindowBackground(dpy, clients[i].frame, px.bar);
+        }
+        redraw_bars = redraw_frames = 1;
+    }
+    if (COLOR_CHANGED(bg_color)) {
+        px.bg = get_pixel(nc.bg_color);
+        XSetWindowBackground(dpy, root, px.bg);
+        XClearWindow(dpy, root);
+    }
+    if (COLOR_CHANGED(border_color)) {
+        px.border = get_pixel(nc.border_color);
+        for (int i = 0; i < client_count; i++) {
+            if (clients[i].frame) XSetWindowBorder(dpy, clients[i].frame, px.border);
+        }
+        redraw_frames = 1;
+    }
+    if (COLOR_CHANGED(active_border_color)) {
+        px.active_border = get_pixel(nc.active_border_color);
+        redraw_bars = redraw_frames = 1;
+    }
+    if (COLOR_CHANGED(button_color)) {
+        px.button = get_pixel(nc.button_color);
+        redraw_frames = 1;
+    }
+    if (COLOR_CHANGED(text_color)) {
+        px.text = get_pixel(nc.text_color);
+        redraw_bars = redraw_frames = 1;
+    }
+    if (COLOR_CHANGED(line_color)) {
+        px.line = get_pixel(nc.line_color);
+        redraw_bars = redraw_frames = 1;
+    }
+    if (COLOR_CHANGED(highlight_color)) {
+        px.highlight = get_pixel(nc.highlight_color);
+    }
+#undef COLOR_CHANGED
+
+    if (strcmp(conf.font_name, nc.font_name) != 0 && load_font(nc.font_name)) {
+        redraw_bars = redraw_frames = 1;
+    }
+
+    if (conf.border_width != nc.border_width) {
+        for (int i = 0; i < client_count; i++) {
+            if (clients[i].frame) XSetWindowBorderWidth(dpy, clients[i].frame, nc.border_width);
+        }
+    }
+
+    unsigned int new_mouse_mask = str_to_mod(nc.mouse_mod);
+    if (new_mouse_mask == 0) new_mouse_mask = Mod1Mask;
+    if (new_mouse_mask != mouse_mod_mask) {
+        grab_root_buttons(0);
+        for (int i = 0; i < client_count; i++) {
+            if (clients[i].frame) XUngrabButton(dpy, AnyButton, AnyModifier, clients[i].client);
+        }
+        mouse_mod_mask = new_mouse_mask;
+        grab_root_buttons(1);
+        for (int i = 0; i < client_count; i++) {
+            if (clients[i].frame) grab_client_buttons(clients[i].client);
+        }
+    }
+
     for (int i = 0; i < bind_count; i++) {
-        if (binds[i].key == key && binds[i].mod == clean_state) {
-            const char *cmd = binds[i].command;
-            
-            if (strcasecmp(cmd, "quit") == 0) {
-                running = 0;
-            } else if (strcasecmp(cmd, "alttab") == 0) {
-                alt_tab_show();
-            } else if (strcasecmp(cmd, "menu") == 0) {
-                show_hidden_menu();
-            } else if (strcasecmp(cmd, "unhide") == 0) {
-                unhide_all();
-            } else if (strcasecmp(cmd, "close") == 0) {
-                if (focus_window) close_client(focus_window);
-            } else if (strcasecmp(cmd, "fullscreen") == 0) {
-                if (focus_window) toggle_fullscreen(focus_window);
-            } else if (strcasecmp(cmd, "snap_left") == 0) {
-                if (focus_window) snap_window(focus_window, 0);
-            } else if (strcasecmp(cmd, "snap_right") == 0) {
-                if (focus_window) snap_window(focus_window, 1);
-            } else if (strcasecmp(cmd, "maximize") == 0) {
-                if (focus_window) snap_window(focus_window, 2);
-            } else if (strcasecmp(cmd, "restore") == 0) {
-                if (focus_window) snap_window(focus_window, 3);
-            } else {
-                spawn(cmd);
+        if (!bind_in_set(&binds[i], nb, nb_count)) grab_bind(&binds[i], 0);
+    }
+    for (int i = 0; i < nb_count; i++) {
+        if (!bind_in_set(&nb[i], binds, bind_count)) grab_bind(&nb[i], 1);
+    }
+
+    nc.workspaces = clamp_workspaces(nc.workspaces);
+    int border_changed = conf.border_width != nc.border_width;
+    int workspaces_changed = conf.workspaces != nc.workspaces;
+    int status_changed = conf.status_count != nc.status_count ||
+                         memcmp(conf.status, nc.status, sizeof(conf.status)) != 0;
+    conf = nc;
+    if (!conf.preview) {
+        for (int i = 0; i < client_count; i++) thumb_free(&clients[i]);
+    }
+    thumb_evict(NULL);
+    memcpy(binds, nb, sizeof(KeyBind) * nb_count);
+    bind_count = nb_count;
+    ruleset = nrs;
+
+    if (border_changed) {
+        for (int i = 0; i < client_count; i++) grid_update(&clients[i]);
+        for (int i = 0; i < monitor_count; i++) mark_monitor_dirty(i);
+    }
+
+    if (workspaces_changed) {
+        for (int i = 0; i < monitor_count; i++) {
+            if (monitors[i].workspace >= conf.workspaces) monitors[i].workspace = conf.workspaces - 1;
+        }
+        for (int i = 0; i < client_count; i++) {
+            ClientState *cs = &clients[i];
+            if (cs->workspace >= conf.workspaces) {
+                cs->workspace = conf.workspaces - 1;
+                if (cs->frame) set_client_desktop(cs);
             }
-            return;
+            sync_visibility(cs);
         }
+        ClientState *fc = get_client_state(focus_window);
+        if (fc && !client_visible(fc)) focus_client(last_focused_on(active_monitor));
+        update_desktop_hints();
+        redraw_bars = 1;
+    }
+
+    if (status_changed) {
+        status_init();
+        redraw_bars = 1;
     }
+
+    if (redraw_frames) redraw_all_frames();
+    if (redraw_bars) update_all_bars();
 }
 
-void grab_keys(void) {
-    XUngrabKey(dpy, AnyKey, AnyModifier, root);
-    
-    for (int i = 0; i < bind_count; i++) {
-        KeyCode kc = XKeysymToKeycode(dpy, binds[i].key);
-        if (!kc) continue;
-        
-        unsigned int modifiers[] = {
-            binds[i].mod,
-            binds[i].mod | Mod2Mask,
-            binds[i].mod | LockMask,
-            binds[i].mod | Mod2Mask | LockMask,
-        };
-        
-        for (int m = 0; m < 4; m++) {
-            XGrabKey(dpy, kc, modifiers[m], root, True, 
-                     GrabModeAsync, GrabModeAsync);
+void watch_config(void) {
+    const char *home = getenv("HOME");
+    if (!home) return;
+
+    char dir_path[256];
+    snprintf(dir_path, sizeof(dir_path), "%s/.config", home);
+
+    config_watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (config_watch_fd < 0) return;
+    if (inotify_add_watch(config_watch_fd, dir_path, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        close(config_watch_fd);
+        config_watch_fd = -1;
+    }
+}
+
+int config_changed(void) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int changed = 0;
+    ssize_t len;
+
+    while ((len = read(config_watch_fd, buf, sizeof(buf))) > 0) {
+        for (char *ptr = buf; ptr < buf + len; ) {
+            struct inotify_event *ie = (struct inotify_event *)ptr;
+            if (ie->len && strcmp(ie->name, "lwm.conf") == 0) changed = 1;
+            ptr += sizeof(struct inotify_event) + ie->len;
         }
     }
-    
-    XSync(dpy, False);
+    return changed;
 }
 
 void cleanup(void) {
@@ -1375,9 +5063,263 @@ void cleanup(void) {
         XFreeFont(dpy, font_info);
         font_info = NULL;
     }
+#ifdef HAVE_XFT
+    if (xft_draw) XftDrawDestroy(xft_draw);
+    if (xft_font) XftFontClose(dpy, xft_font);
+    xft_draw = NULL;
+    xft_font = NULL;
+#endif
+
+    if (config_watch_fd >= 0) {
+        close(config_watch_fd);
+        config_watch_fd = -1;
+    }
+
+    status_close();
+    icon_close();
+    session_flush();
+    session_close();
+    snapshot_close();
+    ipc_close();
+}
+
+int save_state(void) {
+    int fd = memfd_create("lwm-state", 0);
+    if (fd < 0) return -1;
+
+    RestartHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = RESTART_MAGIC;
+    hdr.version = RESTART_VERSION;
+    hdr.count = client_count;
+    hdr.monitors = monitor_count;
+    hdr.focus = focus_window;
+
+    int ok = write(fd, &hdr, sizeof(hdr)) == (ssize_t)sizeof(hdr);
+    for (int i = 0; ok && i < client_count; i++) {
+        RestartRecord r;
+        memset(&r, 0, sizeof(r));
+        r.frame = clients[i].frame;
+        r.client = clients[i].client;
+        r.monitor = clients[i].monitor;
+        r.is_fullscreen = clients[i].is_fullscreen;
+        r.is_hidden = clients[i].is_hidden;
+        r.workspace = clients[i].workspace;
+        r.ws_hidden = clients[i].ws_hidden;
+        r.tile_order = clients[i].tile_order;
+        r.last_focus = clients[i].last_focus;
+        ClientCold *cc = cold(&clients[i]);
+        r.old_x = cc->old_x;
+        r.old_y = cc->old_y;
+        r.old_w = cc->old_w;
+        r.old_h = cc->old_h;
+        r.protocols = cc->protocols;
+        r.protocols_valid = cc->protocols_valid;
+        r.pid = cc->pid;
+        snprintf(r.title, sizeof(r.title), "%s", cc->title);
+        snprintf(r.wm_class, sizeof(r.wm_class), "%s", cc->wm_class);
+        SessionRecord rec;
+        if (cc->session_slot >= 0 && session_read(&session_recs[cc->session_slot], &rec)) {
+            snprintf(r.session_key, sizeof(r.session_key), "%s", rec.key);
+        }
+        r.x = clients[i].x;
+        r.y = clients[i].y;
+        r.w = clients[i].w;
+        r.h = clients[i].h;
+        ok = write(fd, &r, sizeof(r)) == (ssize_t)sizeof(r);
+    }
+
+    RestartMonitor mr[monitor_count];
+    for (int i = 0; i < monitor_count; i++) {
+        mr[i].workspace = monitors[i].workspace;
+        mr[i].layout = monitors[i].layout;
+    }
+    ok = ok && write(fd, mr, sizeof(mr)) == (ssize_t)sizeof(mr);
+
+    if (!ok) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int restore_valid(const RestartRecord *r) {
+    int top = r->is_fullscreen ? 0 : TITLE_HEIGHT;
+    return r->frame && r->w >= MIN_SIZE && r->h > top &&
+           !(r->protocols & ~(PROTO_DELETE | PROTO_PING)) &&
+           memchr(r->title, '\0', sizeof(r->title)) && memchr(r->wm_class, '\0', sizeof(r->wm_class)) &&
+           memchr(r->session_key, '\0', sizeof(r->session_key));
+}
+
+void restore_client(const RestartRecord *r) {
+    if (!r->client || get_client_state(r->client)) return;
+    if (!restore_valid(r)) {
+        frame_window(r->client);
+        return;
+    }
+
+    int top = r->is_fullscreen ? 0 : TITLE_HEIGHT;
+    int mon = r->monitor;
+    if (mon < 0 || mon >= monitor_count) mon = 0;
+    int was_mapped = !r->is_hidden && !r->ws_hidden;
+
+    Window frame = XCreateSimpleWindow(dpy, root, r->x, r->y, r->w, r->h,
+                                       conf.border_width, px.border, px.bar);
+    XSelectInput(dpy, r->client, CLIENT_EVENT_MASK);
+    XSelectInput(dpy, frame, FRAME_EVENT_MASK);
+    XReparentWindow(dpy, r->client, frame, 0, top);
+    XAddToSaveSet(dpy, r->client);
+    grab_client_buttons(r->client);
+
+    add_client(r->client, frame, mon);
+    ClientState *cs = get_client_state(r->client);
+    if (!cs) {
+        XDestroyWindow(dpy, frame);
+        return;
+    }
+    ClientCold *cc = cold(cs);
+    cs->x = r->x;
+    cs->y = r->y;
+    cs->w = r->w;
+    cs->h = r->h;
+    cs->is_fullscreen = r->is_fullscreen != 0;
+    cs->is_hidden = r->is_hidden != 0;
+    cs->workspace = (r->workspace >= 0 && r->workspace < conf.workspaces) ? r->workspace : 0;
+    cs->ws_hidden = !cs->is_hidden && !on_current_workspace(cs);
+    cs->last_focus = r->last_focus;
+    cs->tile_order = r->tile_order;
+    cc->old_x = r->old_x;
+    cc->old_y = r->old_y;
+    cc->old_w = r->old_w;
+    cc->old_h = r->old_h;
+    cc->protocols = r->protocols;
+    cc->protocols_valid = r->protocols_valid != 0;
+    cc->pid = r->pid > 0 ? r->pid : 0;
+    snprintf(cc->title, sizeof(cc->title), "%s", r->title);
+    snprintf(cc->wm_class, sizeof(cc->wm_class), "%s", r->wm_class);
+    cc->session_slot = r->session_key[0] ? session_find(r->session_key, 1) : -1;
+    if (r->tile_order > tile_serial) tile_serial = r->tile_order;
+    if (r->last_focus > focus_serial) focus_serial = r->last_focus;
+
+    icon_request(cs);
+    set_client_desktop(cs);
+    if (cs->is_fullscreen) set_fullscreen_state(cs);
+    grid_update(cs);
+
+    if (cs->is_hidden || cs->ws_hidden) {
+        if (was_mapped) {
+            XUnmapWindow(dpy, r->client);
+            cc->ignore_unmap++;
+        }
+        set_wm_state(r->client, IconicState);
+        return;
+    }
+    XMapWindow(dpy, r->client);
+    set_wm_state(r->client, NormalState);
+    XMapWindow(dpy, frame);
+}
+
+void restore_state(int fd) {
+    RestartHeader hdr;
+    if (pread(fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) ||
+        hdr.magic != RESTART_MAGIC || hdr.version != RESTART_VERSION ||
+        hdr.count > MAX_CLIENTS) {
+        close(fd);
+        return;
+    }
+
+    size_t len = sizeof(RestartRecord) * hdr.count;
+
+    for (unsigned int i = 0; i < hdr.monitors && i < (unsigned int)monitor_count; i++) {
+        RestartMonitor mr;
+        if (pread(fd, &mr, sizeof(mr), sizeof(hdr) + len + i * sizeof(mr)) != (ssize_t)sizeof(mr)) break;
+        if (mr.workspace >= 0 && mr.workspace < conf.workspaces) monitors[i].workspace = mr.workspace;
+        if (mr.layout >= LAYOUT_FLOAT && mr.layout <= LAYOUT_GRID) monitors[i].layout = mr.layout;
+    }
+
+    trapped_count = 0;
+    trap_errors = 1;
+
+    for (unsigned int i = 0; i < hdr.count; i++) {
+        RestartRecord r;
+        if (pread(fd, &r, sizeof(r), sizeof(hdr) + i * sizeof(r)) != (ssize_t)sizeof(r)) break;
+        restore_client(&r);
+    }
+    close(fd);
+
+    XSync(dpy, False);
+    trap_errors = 0;
+
+    for (int i = 0; i < trapped_count; i++) {
+        ClientState *cs = get_client_state(trapped_errors[i]);
+        if (!cs) cs = get_client_state_by_frame(trapped_errors[i]);
+        if (!cs) continue;
+        if (cs->frame) XDestroyWindow(dpy, cs->frame);
+        remove_client(cs->client);
+    }
+
+    for (int i = 0; i < client_count; i++) {
+        sync_visibility(&clients[i]);
+    }
+    for (int i = 0; i < monitor_count; i++) mark_monitor_dirty(i);
+    update_client_list();
+
+    ClientState *cs = get_client_state(hdr.focus);
+    if (cs) {
+        XSetInputFocus(dpy, cs->client, RevertToPointerRoot, CurrentTime);
+        focus_window = cs->client;
+        set_active_monitor(cs->monitor);
+        set_active_window(focus_window);
+    }
+}
+
+void release_clients(int keep_hidden) {
+    for (int i = 0; i < client_count; i++) {
+        if (!clients[i].frame) continue;
+        XReparentWindow(dpy, clients[i].client, root, clients[i].x,
+                        clients[i].y + client_top(&clients[i]));
+        if (!keep_hidden || client_visible(&clients[i])) XMapWindow(dpy, clients[i].client);
+        XRemoveFromSaveSet(dpy, clients[i].client);
+        XDestroyWindow(dpy, clients[i].frame);
+    }
+}
+
+void restart_wm(void) {
+    int fd = save_state();
+
+    release_clients(1);
+    cleanup();
+    XCloseDisplay(dpy);
+
+    if (fd >= 0) {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%d", fd);
+        setenv(RESTART_ENV, buf, 1);
+    }
+
+    execvp(saved_argv[0], saved_argv);
+    execv("/proc/self/exe", saved_argv);
+    fprintf(stderr, "Cannot restart lwm\n");
+    exit(1);
 }
 
-int main(void) {
+int main(int argc, char **argv) {
+    (void)argc;
+    saved_argv = argv;
+    XInitThreads();
+
+    int restart_fd = -1;
+    const char *restart_env = getenv(RESTART_ENV);
+    if (restart_env) {
+        char *end;
+        long fd = strtol(restart_env, &end, 10);
+        if (end != restart_env && !*end && fd > STDERR_FILENO && fd < INT_MAX &&
+            fcntl((int)fd, F_GETFD) != -1) {
+            restart_fd = (int)fd;
+        }
+        unsetenv(RESTART_ENV);
+    }
+
     load_config();
 
     dpy = XOpenDisplay(NULL);
@@ -1389,14 +5331,26 @@ int main(void) {
     XSetErrorHandler(x_error_handler);
     XSync(dpy, False);
 
+    arena_init(&batch_arena, BATCH_ARENA_SIZE);
+    arena_init(&alt_tab_arena, ALT_TAB_ARENA_SIZE);
+    arena_init(&menu_arena, MENU_ARENA_SIZE);
+
     root = DefaultRootWindow(dpy);
     
     detect_monitors();
+    grid_init();
     init_hints();
 
-    font_info = XLoadQueryFont(dpy, conf.font_name);
-    if (!font_info) font_info = XLoadQueryFont(dpy, "fixed");
-    if (!font_info) {
+    int randr_error_base;
+    if (XRRQueryExtension(dpy, &randr_event_base, &randr_error_base)) {
+        XRRSelectInput(dpy, root, RRScreenChangeNotifyMask);
+    } else {
+        randr_event_base = -1;
+    }
+
+    alloc_pixels();
+
+    if (!load_font(conf.font_name)) {
         fprintf(stderr, "Cannot load font\n");
         XCloseDisplay(dpy);
         return 1;
@@ -1407,42 +5361,41 @@ int main(void) {
     Cursor cursor = XCreateFontCursor(dpy, XC_left_ptr);
     XDefineCursor(dpy, root, cursor);
 
-    XSetWindowBackground(dpy, root, get_pixel(conf.bg_color));
+    XSetWindowBackground(dpy, root, px.bg);
     XClearWindow(dpy, root);
-    XSelectInput(dpy, root, SubstructureRedirectMask | SubstructureNotifyMask | 
-                 KeyPressMask | KeyReleaseMask);
+    XSelectInput(dpy, root, ROOT_EVENT_MASK);
 
     grab_keys();
-
-    unsigned int mods[] = { 
-        mouse_mod_mask, 
-        mouse_mod_mask | Mod2Mask,
-        mouse_mod_mask | LockMask, 
-        mouse_mod_mask | Mod2Mask | LockMask 
-    };
-    for (int m = 0; m < 4; m++) {
-        XGrabButton(dpy, Button1, mods[m], root, True, ButtonPressMask,
-                    GrabModeAsync, GrabModeAsync, None, None);
-        XGrabButton(dpy, Button3, mods[m], root, True, ButtonPressMask,
-                    GrabModeAsync, GrabModeAsync, None, None);
-    }
+    grab_root_buttons(1);
+#ifndef STATIC_CONFIG
+    watch_config();
+#endif
 
     signal(SIGCHLD, SIG_IGN);
+    status_init();
+    session_open();
+    snapshot_open();
+    ipc_open();
+    icon_open();
+
+    if (restart_fd >= 0) restore_state(restart_fd);
 
     Window root_ret, parent_ret, *children = NULL;
     unsigned int nchildren;
     if (XQueryTree(dpy, root, &root_ret, &parent_ret, &children, &nchildren)) {
         for (unsigned int i = 0; i < nchildren; i++) {
-            if (!is_bar_window(children[i])) {
+            if (!is_bar_window(children[i]) && !get_client_state(children[i]) &&
+                !get_client_state_by_frame(children[i])) {
                 XWindowAttributes attr;
-                if (XGetWindowAttributes(dpy, children[i], &attr) &&
-                    attr.map_state == IsViewable && !attr.override_redirect) {
+                if (XGetWindowAttributes(dpy, children[i], &attr) && !attr.override_redirect &&
+                    (attr.map_state == IsViewable || get_wm_state(children[i]) == IconicState)) {
                     frame_window(children[i]);
                 }
             }
         }
         if (children) XFree(children);
     }
+    update_desktop_hints();
 
     int x11_fd = ConnectionNumber(dpy);
     XEvent ev;
@@ -1450,6 +5403,15 @@ int main(void) {
     while (running) {
         while (XPending(dpy)) {
             XNextEvent(dpy, &ev);
+#ifdef LWM_ALLOC_CHECK
+            alloc_watch(ev.type);
+#endif
+
+            if (randr_event_base >= 0 && ev.type == randr_event_base + RRScreenChangeNotify) {
+                XRRUpdateConfiguration(&ev);
+                update_monitors();
+                continue;
+            }
 
             if (alt_tab.active) {
                 if (ev.type == Expose && ev.xexpose.window == alt_tab.menu_win) {
@@ -1465,10 +5427,17 @@ int main(void) {
                         alt_tab_cancel();
                     } else if (ks == XK_Return) {
                         alt_tab_confirm();
-                    } else if (ks == XK_Up || ks == XK_k) {
+                    } else if (ks == XK_Up || ks == XK_Left) {
                         alt_tab_prev();
-                    } else if (ks == XK_Down || ks == XK_j) {
+                    } else if (ks == XK_Down || ks == XK_Right) {
                         alt_tab_next();
+                    } else if (ks == XK_BackSpace) {
+                        alt_tab_erase();
+                    } else {
+                        char c;
+                        if (XLookupString(&ev.xkey, &c, 1, NULL, NULL) == 1 && c >= ' ' && c < 0x7f) {
+                            alt_tab_type(c);
+                        }
                     }
                     continue;
                 }
@@ -1489,21 +5458,15 @@ int main(void) {
                     break;
                     
                 case UnmapNotify:
-                    if (ev.xunmap.event == root) break;
                     {
-                        Window frame = get_frame(ev.xunmap.window);
-                        if (frame) {
-                            XWindowAttributes attr;
-                            if (XGetWindowAttributes(dpy, ev.xunmap.window, &attr) == 0) {
-                                XDestroyWindow(dpy, frame);
-                                remove_client(ev.xunmap.window);
-                                update_client_list();
-                                if (focus_window == ev.xunmap.window) {
-                                    focus_window = 0;
-                                    update_all_bars();
-                                }
-                            }
+                        ClientState *cs = get_client_state(ev.xunmap.window);
+                        if (!cs) break;
+                        if (cs->frame && ev.xunmap.event == root && !ev.xunmap.send_event) break;
+                        if (cold(cs)->ignore_unmap > 0 && !ev.xunmap.send_event) {
+                            cold(cs)->ignore_unmap--;
+                            break;
                         }
+                        withdraw_client(cs);
                     }
                     break;
                     
@@ -1536,6 +5499,11 @@ int main(void) {
                     
                 case ConfigureRequest:
                     {
+                        ClientState *cs = get_client_state(ev.xconfigurerequest.window);
+                        if (cs && cs->frame) {
+                            queue_configure(cs, &ev.xconfigurerequest);
+                            break;
+                        }
                         XWindowChanges wc;
                         wc.x = ev.xconfigurerequest.x;
                         wc.y = ev.xconfigurerequest.y;
@@ -1551,24 +5519,30 @@ int main(void) {
                     
                 case ClientMessage:
                     if (ev.xclient.message_type == wmatoms[NET_WM_STATE]) {
-                        if ((Atom)ev.xclient.data.l[1] == wmatoms[NET_WM_STATE_FULLSCREEN] ||
-                            (Atom)ev.xclient.data.l[2] == wmatoms[NET_WM_STATE_FULLSCREEN]) {
-                            toggle_fullscreen(ev.xclient.window);
+                        ClientState *cs = get_client_state(ev.xclient.window);
+                        if (cs && ((Atom)ev.xclient.data.l[1] == wmatoms[NET_WM_STATE_FULLSCREEN] ||
+                                   (Atom)ev.xclient.data.l[2] == wmatoms[NET_WM_STATE_FULLSCREEN])) {
+                            long action = ev.xclient.data.l[0];
+                            int want = (action == 2) ? !cs->is_fullscreen : (action == 1);
+                            if (want != cs->is_fullscreen) toggle_fullscreen(cs->client);
+                        }
+                    } else if (ev.xclient.message_type == wmatoms[WM_PROTOCOLS] &&
+                               (Atom)ev.xclient.data.l[0] == wmatoms[NET_WM_PING]) {
+                        ping_reply((Window)ev.xclient.data.l[2]);
+                    } else if (ev.xclient.message_type == wmatoms[WM_CHANGE_STATE]) {
+                        if (ev.xclient.data.l[0] == IconicState) {
+                            hide_client(get_client_state(ev.xclient.window));
                         }
                     } else if (ev.xclient.message_type == wmatoms[NET_ACTIVE_WINDOW]) {
-                        Window frame = get_frame(ev.xclient.window);
-                        if (frame) {
-                            XMapWindow(dpy, frame);
-                            XRaiseWindow(dpy, frame);
-                            raise_bars();
-                            XSetInputFocus(dpy, ev.xclient.window, 
-                                          RevertToPointerRoot, CurrentTime);
-                            focus_window = ev.xclient.window;
-                            ClientState *cs = get_client_state(focus_window);
-                            if (cs) active_monitor = cs->monitor;
-                            set_active_window(focus_window);
+                        ClientState *cs = get_client_state(ev.xclient.window);
+                        if (cs && cs->frame) {
+                            activate_client(cs);
                             update_all_bars();
                         }
+                    } else if (ev.xclient.message_type == wmatoms[NET_CURRENT_DESKTOP]) {
+                        switch_workspace(active_monitor, ev.xclient.data.l[0]);
+                    } else if (ev.xclient.message_type == wmatoms[NET_WM_DESKTOP]) {
+                        move_to_workspace(get_client_state(ev.xclient.window), ev.xclient.data.l[0]);
                     }
                     break;
                     
@@ -1578,17 +5552,36 @@ int main(void) {
                         execute_keybind(ks, ev.xkey.state);
                     }
                     break;
+
+                case PropertyNotify:
+                    if (ev.xproperty.window == root) {
+                        if (ev.xproperty.atom == XA_WM_NAME && status_root_name()) status_rebuild();
+                    } else if (ev.xproperty.atom == wmatoms[WM_PROTOCOLS] ||
+                        ev.xproperty.atom == wmatoms[NET_WM_PID]) {
+                        ClientState *cs = get_client_state(ev.xproperty.window);
+                        if (cs) cold(cs)->protocols_valid = 0;
+                    } else if (ev.xproperty.atom == XA_WM_NAME ||
+                               ev.xproperty.atom == wmatoms[NET_WM_NAME]) {
+                        ClientState *cs = get_client_state(ev.xproperty.window);
+                        if (cs && cs->frame) title_changed(cs, now_ms());
+                    } else if (ev.xproperty.atom == wmatoms[NET_WM_ICON]) {
+                        ClientState *cs = get_client_state(ev.xproperty.window);
+                        if (cs && cs->frame) icon_request(cs);
+                    }
+                    break;
                     
                 case EnterNotify:
                     if (!is_bar_window(ev.xcrossing.window) && 
                         ev.xcrossing.window != root) {
                         Window client = find_client_in_frame(ev.xcrossing.window);
+                        ClientState *cs = get_client_state(client);
+                        if (cs && cs->client == focus_window &&
+                            monitors[cs->monitor].fullscreen == cs->frame) break;
                         if (client) {
                             focus_window = client;
                             XSetInputFocus(dpy, focus_window, 
                                           RevertToPointerRoot, CurrentTime);
-                            ClientState *cs = get_client_state(focus_window);
-                            if (cs) active_monitor = cs->monitor;
+                            if (cs) set_active_monitor(cs->monitor);
                             set_active_window(focus_window);
                             update_all_bars();
                         }
@@ -1607,13 +5600,11 @@ int main(void) {
                         if (bar_idx >= 0) {
                             update_bar(bar_idx);
                         } else {
-                            Window client = find_client_in_frame(ev.xexpose.window);
-                            if (client) {
-                                XWindowAttributes fa;
-                                if (XGetWindowAttributes(dpy, ev.xexpose.window, &fa)) {
-                                    draw_decorations(ev.xexpose.window, fa.width, 
-                                                    fa.height - TITLE_HEIGHT);
-                                }
+                            ClientState *cs = get_client_state_by_frame(ev.xexpose.window);
+                            if (cs) {
+                                cs->deco_dirty = 0;
+                                draw_decorations(ev.xexpose.window, cs->w,
+                                                 cs->h - TITLE_HEIGHT);
                             }
                         }
                     }
@@ -1646,7 +5637,7 @@ int main(void) {
                             Window target = parent_frame ? parent_frame : ev.xbutton.subwindow;
                             if (target && !is_bar_window(target) && target != root) {
                                 XWindowAttributes attr;
-                                if (XGetWindowAttributes(dpy, target, &attr)) {
+                                if (get_geometry(target, &attr)) {
                                     start_ev = ev.xbutton;
                                     start_ev.window = target;
                                     start_ev.button = Button1;
@@ -1668,7 +5659,7 @@ int main(void) {
                             Window target = parent_frame ? parent_frame : ev.xbutton.subwindow;
                             if (target && !is_bar_window(target) && target != root) {
                                 XWindowAttributes attr;
-                                if (XGetWindowAttributes(dpy, target, &attr)) {
+                                if (get_geometry(target, &attr)) {
                                     start_ev = ev.xbutton;
                                     start_ev.window = target;
                                     start_ev.button = Button3;
@@ -1696,18 +5687,18 @@ int main(void) {
                                    ev.xbutton.button == Button1) {
                             XAllowEvents(dpy, AsyncPointer, CurrentTime);
                             XWindowAttributes fa;
-                            if (XGetWindowAttributes(dpy, ev.xbutton.window, &fa)) {
+                            if (get_geometry(ev.xbutton.window, &fa)) {
                                 int btn = TITLE_HEIGHT;
                                 if (ev.xbutton.x < btn) {
                                     Window cl = find_client_in_frame(ev.xbutton.window);
                                     if (cl) close_client(cl);
                                 } else if (ev.xbutton.x > fa.width - btn) {
-                                    XUnmapWindow(dpy, ev.xbutton.window);
+                                    hide_client(get_client_state_by_frame(ev.xbutton.window));
                                 } else {
                                     XRaiseWindow(dpy, ev.xbutton.window);
                                     raise_bars();
                                     XWindowAttributes attr;
-                                    if (XGetWindowAttributes(dpy, ev.xbutton.window, &attr)) {
+                                    if (get_geometry(ev.xbutton.window, &attr)) {
                                         drag_state.start_root_x = ev.xbutton.x_root;
                                         drag_state.start_root_y = ev.xbutton.y_root;
                                         drag_state.win_x = attr.x;
@@ -1769,31 +5760,23 @@ int main(void) {
                                 }
                             }
 
-                            XMoveResizeWindow(dpy, start_ev.window, new_x, new_y, new_w, new_h);
-                            Window c = find_client_in_frame(start_ev.window);
-                            if (c) XResizeWindow(dpy, c, new_w, new_h - TITLE_HEIGHT);
-                            
-                            ClientState *cs = get_client_state(c);
+                            ClientState *cs = get_client_state_by_frame(start_ev.window);
                             if (cs) {
-                                cs->monitor = get_monitor_at(new_x + new_w / 2, 
-                                                             new_y + new_h / 2);
+                                configure_client(cs, new_x, new_y, new_w, new_h);
+                            } else {
+                                XMoveResizeWindow(dpy, start_ev.window, new_x, new_y, new_w, new_h);
                             }
                         } else if (start_ev.button == Button1) {
                             int new_x = drag_state.win_x + xdiff;
                             int new_y = drag_state.win_y + ydiff;
                             if (new_y < 0) new_y = 0;
-                            XMoveWindow(dpy, start_ev.window, new_x, new_y);
-                            
-                            Window c = find_client_in_frame(start_ev.window);
-                            ClientState *cs = get_client_state(c);
+                            ClientState *cs = get_client_state_by_frame(start_ev.window);
                             if (cs) {
-                                XWindowAttributes attr;
-                                if (XGetWindowAttributes(dpy, start_ev.window, &attr)) {
-                                    cs->monitor = get_monitor_at(
-                                        attr.x + attr.width / 2,
-                                        attr.y + attr.height / 2);
-                                    active_monitor = cs->monitor;
-                                }
+                                snap_position(cs, &new_x, &new_y);
+                                configure_client(cs, new_x, new_y, cs->w, cs->h);
+                                set_active_monitor(cs->monitor);
+                            } else {
+                                XMoveWindow(dpy, start_ev.window, new_x, new_y);
                             }
                         }
                     }
@@ -1802,6 +5785,8 @@ int main(void) {
                 case ButtonRelease:
                     if (start_ev.window) {
                         XUngrabPointer(dpy, CurrentTime);
+                        ClientState *cs = get_client_state_by_frame(start_ev.window);
+                        if (cs) mark_monitor_dirty(cs->monitor);
                         start_ev.window = 0;
                         update_all_bars();
                     }
@@ -1809,16 +5794,59 @@ int main(void) {
             }
         }
 
-        fd_set fds;
+#ifdef LWM_ALLOC_CHECK
+        alloc_watch(LASTEvent);
+#endif
+        long long now = now_ms();
+        long long title_next = title_tick(now);
+
+        flush_configures();
+        flush_monitors();
+        session_flush();
+        snapshot_flush();
+        ipc_flush();
+        arena_reset(&batch_arena);
+#ifdef LWM_ALLOC_CHECK
+        alloc_watch(0);
+#endif
+
+        long long deadline = status_tick(now);
+        long long ping_next = ping_tick(now);
+        if (ping_next && ping_next < deadline) deadline = ping_next;
+        if (title_next && title_next < deadline) deadline = title_next;
+
+        fd_set fds, wfds;
         FD_ZERO(&fds);
+        FD_ZERO(&wfds);
         FD_SET(x11_fd, &fds);
-        struct timeval tv = {1, 0};
-
-        if (select(x11_fd + 1, &fds, NULL, NULL, &tv) == 0) {
-            update_all_bars();
+        int max_fd = x11_fd;
+        if (config_watch_fd >= 0) {
+            FD_SET(config_watch_fd, &fds);
+            if (config_watch_fd > max_fd) max_fd = config_watch_fd;
+        }
+        ipc_fill_fds(&fds, &wfds, &max_fd);
+        status_fill_fds(&fds, &max_fd);
+        if (icon_done_fd >= 0) {
+            FD_SET(icon_done_fd, &fds);
+            if (icon_done_fd > max_fd) max_fd = icon_done_fd;
         }
+        long long wait = deadline - now;
+        if (wait < 0) wait = 0;
+        struct timeval tv = { wait / 1000, (wait % 1000) * 1000 };
+
+        XFlush(dpy);
+        int ready = select(max_fd + 1, &fds, &wfds, NULL, &tv);
+        if (ready > 0 && config_watch_fd >= 0 && FD_ISSET(config_watch_fd, &fds)) {
+            if (config_changed()) reload_config();
+        }
+        if (ready > 0) ipc_handle(&fds, &wfds);
+        if (ready > 0) status_handle(&fds);
+        if (ready > 0 && icon_done_fd >= 0 && FD_ISSET(icon_done_fd, &fds)) icon_handle();
     }
 
+    if (restarting) restart_wm();
+
+    release_clients(0);
     cleanup();
     XCloseDisplay(dpy);
     return 0;